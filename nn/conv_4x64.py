@@ -5,6 +5,8 @@ import click
 import torch
 from torch import nn
 
+from onnx_export import export_onnx
+
 device = "cpu"
 
 
@@ -95,8 +97,26 @@ def benchmark_model(model):
     help="print number of model parameters and exit",
 )
 @click.option("-b", "--benchmark", is_flag=True)
-def main(output, force, input, encoding_version, num_parameters, benchmark):
-    grid_size = 8
+@click.option(
+    "--packed-input",
+    is_flag=True,
+    help="export with packed uint8 input, unpacked inside the graph",
+)
+@click.option(
+    "--legal-move-output",
+    is_flag=True,
+    help="export with legal-move indices as input and the legal-move softmax as output",
+)
+def main(
+    output,
+    force,
+    input,
+    encoding_version,
+    num_parameters,
+    benchmark,
+    packed_input,
+    legal_move_output,
+):
     encoder_channels = 21 if encoding_version == 0 else 22
     model = ChessNet(in_channels=encoder_channels)
 
@@ -124,24 +144,16 @@ def main(output, force, input, encoding_version, num_parameters, benchmark):
         torch.save(model.state_dict(), output)
     model.eval()
 
-    # Noting that online examples with ONNX export do set requires_grad=True
-    # on the sample input, but not sure if it is necessary.
-    X = torch.rand(
-        1, encoder_channels, grid_size, grid_size, requires_grad=True, device=device
-    )
     # Note that the exported model has fixed shapes for input and output.
     # This should be OK as long as inference is done in batches of 1.  If
-    # needed, we can add a dynamic_axes option to make the first axis (of
+    # needed, we can pass dynamic_batch=True to make the first axis (of
     # input and outputs) dynamic.
-    torch.onnx.export(
+    export_onnx(
         model,
-        X,
         output.replace(".pt", ".onnx"),
-        input_names=["state"],
-        output_names=["policy", "value"],
-        # dynamic_axes={'state' : {0 : 'batch_size'},    # variable length axes
-        #               'policy' : {0 : 'batch_size'},
-        #               'value': {0: 'batch_size'}}
+        encoding_version,
+        packed_input=packed_input,
+        legal_move_output=legal_move_output,
     )
     # print(torch.onnx.export_to_pretty_string(
     #     model, X,
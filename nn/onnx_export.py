@@ -0,0 +1,73 @@
+"""ONNX export of the networks, with optional input and output adapters."""
+
+import torch
+from torch import nn
+
+from packed_input import PackedInputNet, sample_packed_input
+
+GRID_SIZE = 8
+
+
+class LegalMovePolicy(nn.Module):
+    """Gather the policy logits of the legal moves and apply the softmax in the graph.
+
+    Takes the network input, move_indices of shape (N, M) into the flattened 73x8x8
+    policy, with -1 for padding, and the softmax temperature of shape (1,).  The policy
+    output has shape (N, M), and is normalized over the moves that are not padding.
+    """
+
+    def __init__(self, model):
+        super().__init__()
+        self.model = model
+
+    def forward(self, x, move_indices, policy_temperature):
+        policy, value = self.model(x)
+        logits = torch.gather(policy.flatten(1), 1, move_indices.clamp(min=0))
+        logits = logits.masked_fill(move_indices < 0, float("-inf"))
+        return torch.softmax(logits / policy_temperature, dim=1), value
+
+
+def export_onnx(
+    model,
+    path,
+    encoding_version,
+    packed_input=False,
+    legal_move_output=False,
+    dynamic_batch=False,
+):
+    """Export model to path, optionally with packed input and legal-move output.
+
+    Without dynamic_batch, the exported model has a fixed batch size of 1.
+    """
+    if packed_input:
+        model = PackedInputNet(model, encoding_version)
+        args = (sample_packed_input(),)
+        input_names = ["packed_state"]
+    else:
+        # Noting that online examples with ONNX export do set requires_grad=True
+        # on the sample input, but not sure if it is necessary.
+        in_channels = 21 if encoding_version == 0 else 22
+        args = (torch.rand(1, in_channels, GRID_SIZE, GRID_SIZE, requires_grad=True),)
+        input_names = ["state"]
+
+    dynamic_axes = {}
+    if legal_move_output:
+        model = LegalMovePolicy(model)
+        num_sample_moves = 20
+        args += (torch.arange(num_sample_moves).unsqueeze(0), torch.ones(1))
+        input_names += ["move_indices", "policy_temperature"]
+        dynamic_axes["move_indices"] = {1: "num_moves"}
+        dynamic_axes["policy"] = {1: "num_moves"}
+
+    if dynamic_batch:
+        for name in input_names[:2] + ["policy", "value"]:
+            dynamic_axes.setdefault(name, {})[0] = "batch_size"
+
+    torch.onnx.export(
+        model,
+        args,
+        path,
+        input_names=input_names,
+        output_names=["policy", "value"],
+        dynamic_axes=dynamic_axes or None,
+    )
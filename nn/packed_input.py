@@ -0,0 +1,78 @@
+"""Packed network input, expanded to float planes inside the exported graph.
+
+The packed format is PACKED_SIZE uint8 values per position, written by
+SimpleEncoder::encode_packed:
+
+- bytes 0-95: the 12 piece bitboards in plane order, 8 bytes each.  Byte r of a
+  bitboard holds rank r, with bit f set for a piece on file f.
+- bytes 96-103: the en passant square, as a bitboard in the same layout.
+- bytes 104-111: repetitions >= 1, repetitions >= 2, black to move, the four castling
+  flags in plane order, and the no-progress count (saturated at 255).
+
+Board orientation is applied by the encoder before packing, so the prologue only
+expands bits and broadcasts scalars.
+"""
+
+import torch
+from torch import nn
+
+GRID_SIZE = 8
+NUM_PIECE_PLANES = 12
+NUM_BITBOARDS = NUM_PIECE_PLANES + 1
+NUM_SCALARS = 8
+PACKED_SIZE = NUM_BITBOARDS * GRID_SIZE + NUM_SCALARS
+
+
+class UnpackInput(nn.Module):
+    """Expand packed uint8 input of shape (N, PACKED_SIZE) to (N, C, 8, 8) floats."""
+
+    def __init__(self, encoding_version=1):
+        super().__init__()
+        self.en_passant = encoding_version >= 1
+        self.scale_move_count = encoding_version >= 2
+        self.register_buffer(
+            "bit_values", 2.0 ** torch.arange(GRID_SIZE, dtype=torch.float32)
+        )
+
+    def forward(self, x):
+        x = x.float()
+        n = x.shape[0]
+
+        # Extract bit f of each rank byte as floor(byte / 2^f) mod 2.  This uses
+        # only float arithmetic, which all execution providers support.
+        ranks = x[:, : NUM_BITBOARDS * GRID_SIZE]
+        ranks = ranks.reshape(n, NUM_BITBOARDS, GRID_SIZE, 1)
+        bits = torch.floor(ranks / self.bit_values)
+        bits = bits - 2 * torch.floor(bits / 2)
+
+        s = x[:, NUM_BITBOARDS * GRID_SIZE :]
+        fifty_move = s[:, 7:8]
+        if self.scale_move_count:
+            fifty_move = fifty_move / 100
+        # Repetitions (2), side to move, constant plane, castling (4), no-progress count
+        scalars = torch.cat(
+            [s[:, 0:3], torch.ones_like(s[:, 0:1]), s[:, 3:7], fifty_move], dim=1
+        )
+        scalar_planes = scalars.reshape(n, -1, 1, 1)
+        scalar_planes = scalar_planes.expand(-1, -1, GRID_SIZE, GRID_SIZE)
+
+        planes = [bits[:, :NUM_PIECE_PLANES], scalar_planes]
+        if self.en_passant:
+            planes.append(bits[:, NUM_PIECE_PLANES:])
+        return torch.cat(planes, dim=1)
+
+
+class PackedInputNet(nn.Module):
+    """Wrap a network so that it takes packed input, for ONNX export."""
+
+    def __init__(self, model, encoding_version=1):
+        super().__init__()
+        self.unpack = UnpackInput(encoding_version)
+        self.model = model
+
+    def forward(self, x):
+        return self.model(self.unpack(x))
+
+
+def sample_packed_input(batch_size=1):
+    return torch.randint(0, 2, (batch_size, PACKED_SIZE), dtype=torch.uint8)
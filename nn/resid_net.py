@@ -5,6 +5,8 @@ import click
 import torch
 from torch import nn
 
+from onnx_export import export_onnx
+
 
 class ResidualBlock(nn.Module):
     def __init__(self, in_channels, out_channels):
@@ -135,6 +137,16 @@ def benchmark_model(model):
     help="print number of model parameters and exit",
 )
 @click.option("-b", "--benchmark", is_flag=True)
+@click.option(
+    "--packed-input",
+    is_flag=True,
+    help="export with packed uint8 input, unpacked inside the graph",
+)
+@click.option(
+    "--legal-move-output",
+    is_flag=True,
+    help="export with legal-move indices as input and the legal-move softmax as output",
+)
 @click.option("--input-conv", is_flag=True, help="include convolution before blocks")
 @click.option("--num-filters", default=64, show_default=True)
 @click.option("--num-blocks", default=4, show_default=True)
@@ -145,11 +157,12 @@ def main(
     encoding_version,
     num_parameters,
     benchmark,
+    packed_input,
+    legal_move_output,
     input_conv,
     num_filters,
     num_blocks,
 ):
-    grid_size = 8
     encoder_channels = 21 if encoding_version == 0 else 22
     model = ChessNet(
         in_channels=encoder_channels,
@@ -182,22 +195,13 @@ def main(
         torch.save(model.state_dict(), output)
     model.eval()
 
-    X = torch.rand(1, encoder_channels, grid_size, grid_size, requires_grad=True)
-    # Note that the exported model has fixed shapes for input and output.
-    # This should be OK as long as inference is done in batches of 1.  If
-    # needed, we can add a dynamic_axes option to make the first axis (of
-    # input and outputs) dynamic.
-    torch.onnx.export(
+    export_onnx(
         model,
-        X,
         output.replace(".pt", ".onnx"),
-        input_names=["state"],
-        output_names=["policy", "value"],
-        dynamic_axes={
-            "state": {0: "batch_size"},  # variable length axes
-            "policy": {0: "batch_size"},
-            "value": {0: "batch_size"},
-        },
+        encoding_version,
+        packed_input=packed_input,
+        legal_move_output=legal_move_output,
+        dynamic_batch=True,
     )
 
 
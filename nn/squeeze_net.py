@@ -6,6 +6,8 @@ import torch
 from torch import nn
 from torchvision.ops import SqueezeExcitation
 
+from onnx_export import export_onnx
+
 
 class ResidSEBlock(nn.Module):
     def __init__(self, in_channels, out_channels, squeeze_channels):
@@ -143,6 +145,16 @@ def benchmark_model(model):
     help="print number of model parameters and exit",
 )
 @click.option("-b", "--benchmark", is_flag=True)
+@click.option(
+    "--packed-input",
+    is_flag=True,
+    help="export with packed uint8 input, unpacked inside the graph",
+)
+@click.option(
+    "--legal-move-output",
+    is_flag=True,
+    help="export with legal-move indices as input and the legal-move softmax as output",
+)
 @click.option("--input-conv", is_flag=True, help="include convolution before blocks")
 @click.option("--num-filters", default=64, show_default=True)
 @click.option("--num-blocks", default=4, show_default=True)
@@ -153,11 +165,12 @@ def main(
     encoding_version,
     num_parameters,
     benchmark,
+    packed_input,
+    legal_move_output,
     input_conv,
     num_filters,
     num_blocks,
 ):
-    grid_size = 8
     encoder_channels = 21 if encoding_version == 0 else 22
     model = ChessNet(
         in_channels=encoder_channels,
@@ -190,18 +203,13 @@ def main(
         torch.save(model.state_dict(), output)
     model.eval()
 
-    X = torch.rand(1, encoder_channels, grid_size, grid_size, requires_grad=True)
-    torch.onnx.export(
+    export_onnx(
         model,
-        X,
         output.replace(".pt", ".onnx"),
-        input_names=["state"],
-        output_names=["policy", "value"],
-        dynamic_axes={
-            "state": {0: "batch_size"},  # variable length axes
-            "policy": {0: "batch_size"},
-            "value": {0: "batch_size"},
-        },
+        encoding_version,
+        packed_input=packed_input,
+        legal_move_output=legal_move_output,
+        dynamic_batch=True,
     )
 
 
@@ -5,7 +5,7 @@
 
 class Agent {
  public:
-  virtual chess::Move select_move(const chess::Board&) = 0;
+  virtual chess::Move select_move(const chess::Board&, const chess::History&) = 0;
   virtual void set_search_time(std::optional<int> move_time_ms,
                                std::optional<int> time_left_ms,
                                std::optional<int> inc_ms,
@@ -5,7 +5,7 @@
 using chess::Move;
 using chess::Board;
 
-Move RandomAgent::select_move(const Board& b) {
+Move RandomAgent::select_move(const Board& b, const chess::History& /* history */) {
   auto candidates = b.generate_legal_moves();
 
   if (candidates.empty())
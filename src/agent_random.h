@@ -6,7 +6,7 @@
 
 class RandomAgent : public Agent {
 public:
-  chess::Move select_move(const chess::Board& b) override;
+  chess::Move select_move(const chess::Board& b, const chess::History& /* history */) override;
 };
 
 
@@ -0,0 +1,150 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <thread>
+#include <optional>
+
+#include <cxxopts.hpp>
+
+#include "chess/board.h"
+#include "zero/cached_inference.h"
+#include "zero/inference_options.h"
+#include "simulation.h"
+#include "utils.h"
+
+using namespace zero;
+
+
+namespace {
+
+  /// Evaluations per second with the given options, or nothing if the options are not
+  /// supported.
+  std::optional<double> measure(const std::string& network_path, const InferenceOptions& options,
+                                const std::shared_ptr<Encoder>& encoder,
+                                const std::vector<chess::Board>& positions, int num_warmup) {
+    std::shared_ptr<InferenceModel> model;
+    try {
+      model = std::make_shared<InferenceModel>(network_path.c_str(), options);
+    } catch (const std::exception& e) {
+      std::cout << "  skipped: " << e.what() << std::endl;
+      return std::nullopt;
+    }
+    CachedInferenceModel cached_model(model, encoder, static_cast<int>(positions.size()), 1.0, true);
+
+    bool cache_hit;
+    for (int i=0; i<num_warmup; ++i)
+      cached_model(positions[i], cache_hit);
+
+    const utils::Timer timer;
+    for (size_t i=num_warmup; i<positions.size(); ++i)
+      cached_model(positions[i], cache_hit);
+    return static_cast<double>(positions.size() - num_warmup) / timer.elapsed();
+  }
+
+  /// Intra-op thread counts to try: powers of two up to the maximum, and the maximum.
+  std::vector<int> thread_counts(int max_threads) {
+    std::vector<int> counts;
+    for (int n=1; n<max_threads; n*=2)
+      counts.push_back(n);
+    counts.push_back(max_threads);
+    return counts;
+  }
+
+};
+
+
+int main(int argc, const char* argv[]) {
+
+  cxxopts::Options options("autotune", "Find the fastest inference options for a network on this machine");
+
+  options.add_options()
+    ("network", "Path to network file", cxxopts::value<std::string>())
+    ("o,output", "Inference options file to write", cxxopts::value<std::string>()->default_value("inference.cfg"))
+    ("n,num-evals", "Number of timed evaluations per configuration", cxxopts::value<int>()->default_value("500"))
+    ("w,warmup", "Number of untimed evaluations per configuration", cxxopts::value<int>()->default_value("50"))
+    ("max-threads", "Maximum number of intra-op threads (default: hardware threads)", cxxopts::value<int>())
+    ("encoding-version", "Version of network input encoding", cxxopts::value<int>()->default_value("2"))
+    ("seed", "Random seed for the sample positions", cxxopts::value<unsigned int>()->default_value("1"))
+    ("h,help", "Print usage")
+    ;
+
+  options.parse_positional({"network"});
+  options.positional_help("<network>");
+
+  cxxopts::ParseResult args;
+  try {
+    args = options.parse(argc, argv);
+  }
+  catch (const cxxopts::exceptions::exception& e) {
+    std::cout << options.help() << std::endl;
+    exit(1);
+  }
+
+  if (args.count("help")) {
+    std::cout << options.help() << std::endl;
+    exit(0);
+  }
+
+  if (! args.count("network")) {
+    std::cout << options.help() << std::endl;
+    exit(1);
+  }
+
+  const auto network_path = args["network"].as<std::string>();
+  const auto output_path = args["output"].as<std::string>();
+  const auto num_evals = args["num-evals"].as<int>();
+  const auto num_warmup = args["warmup"].as<int>();
+  const auto encoding_version = args["encoding-version"].as<int>();
+  const int max_threads = args.count("max-threads") ? args["max-threads"].as<int>()
+    : std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+
+  auto encoder = std::make_shared<SimpleEncoder>(encoding_version);
+  const auto positions = random_positions(num_warmup + num_evals, args["seed"].as<unsigned int>());
+
+  // The search evaluates one position at a time, so configurations are timed with a
+  // batch size of one, through the same cached model as the search.
+  std::vector<InferenceOptions> candidates;
+  for (const auto& provider : available_providers()) {
+    for (const auto* optimization : {"basic", "extended", "all"}) {
+      for (int intra_threads : thread_counts(max_threads)) {
+        InferenceOptions candidate;
+        candidate.provider = provider;
+        candidate.optimization = optimization;
+        candidate.intra_threads = intra_threads;
+        candidates.push_back(candidate);
+        // Parallel execution only helps networks with independent branches, such as
+        // the policy and value heads.
+        candidate.parallel = true;
+        candidate.inter_threads = 2;
+        candidates.push_back(candidate);
+      }
+    }
+  }
+
+  std::optional<InferenceOptions> best;
+  double best_rate = 0.0;
+  for (const auto& candidate : candidates) {
+    std::cout << candidate.provider << ", " << candidate.optimization << ", intra " << candidate.intra_threads;
+    if (candidate.parallel)
+      std::cout << ", parallel inter " << candidate.inter_threads;
+    std::cout << std::endl;
+    auto rate = measure(network_path, candidate, encoder, positions, num_warmup);
+    if (! rate)
+      continue;
+    std::cout << "  " << std::fixed << std::setprecision(1) << rate.value() << " evals/s" << std::endl;
+    if (rate.value() > best_rate) {
+      best_rate = rate.value();
+      best = candidate;
+    }
+  }
+
+  if (! best) {
+    std::cerr << "no configuration could be evaluated" << std::endl;
+    exit(1);
+  }
+
+  best->save(output_path);
+  std::cout << "\nFastest (" << std::fixed << std::setprecision(1) << best_rate << " evals/s), saved to "
+            << output_path << ":\n" << best.value();
+}
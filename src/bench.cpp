@@ -0,0 +1,129 @@
+#include <array>
+#include <fstream>
+#include <iomanip>
+
+#include "bench.h"
+#include "hashcat.h"
+#include "utils.h"
+
+
+namespace {
+
+  // Openings, middlegames with both sides castled or not, and endgames with passed
+  // pawns and promotions.
+  constexpr std::array<const char*, 12> BENCH_FENS = {
+    "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+    "r1bqkbnr/pppp1ppp/2n5/4p3/2B1P3/5N2/PPPP1PPP/RNBQK2R b KQkq - 3 3",
+    "rnbqkb1r/pp2pppp/3p1n2/8/3NP3/2N5/PPP2PPP/R1BQKB1R b KQkq - 2 5",
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "r1bq1rk1/ppp2ppp/2np1n2/2b1p3/2B1P3/2PP1N2/PP3PPP/RNBQ1RK1 w - - 0 7",
+    "r2q1rk1/pp2bppp/2n1pn2/3p4/3P4/2NBPN2/PP3PPP/R2Q1RK1 w - - 4 11",
+    "2r3k1/pp3ppp/4p3/3n4/3P4/P4N2/1P3PPP/2R3K1 w - - 0 24",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "8/8/4k3/3p4/3P4/4K3/8/8 w - - 0 50",
+    "6k1/5ppp/8/8/8/8/1r3PPP/R5K1 w - - 0 30",
+    "8/P5k1/8/8/8/8/6K1/8 w - - 0 60",
+    "n1n5/PPPk4/8/8/8/8/4Kppp/5N1N b - - 0 1",
+  };
+
+};
+
+namespace bench {
+
+  BenchResult run(zero::ZeroAgent& agent, int playouts, std::ostream* verbose) {
+    const auto saved_info = agent.info;
+    agent.info.num_rounds = playouts;
+    agent.info.add_noise = false;
+    agent.info.num_randomized_moves = 0;
+    agent.info.time_manager = nullptr;
+    agent.info.have_time_limit = false;
+    agent.info.smart_pruning_factor = 0.0;
+    agent.info.kld_gain_threshold = 0.0;
+    agent.info.gumbel = false;
+    agent.info.tree_memory_limit = 0;
+    agent.info.game_mode = zero::GameMode::none;
+    agent.info.verbose_move_stats = false;
+    agent.info.live_move_stats = false;
+    agent.info.debug = 0;
+    agent.clear_cache();
+
+    BenchResult result;
+    result.playouts = playouts;
+    const auto* counters = perf::thread_group();
+    if (counters)
+      result.hardware.emplace();
+    for (const auto* fen : BENCH_FENS) {
+      const chess::Board b(fen);
+      const chess::History history;
+      const auto start_sample = counters ? counters->read() : perf::Sample();
+      const utils::Timer timer;
+      auto mv = agent.select_move(b, history);
+      result.seconds += timer.elapsed();
+      if (counters)
+        *result.hardware += counters->read() - start_sample;
+
+      const auto& stats = agent.last_search_stats();
+      result.nodes += stats.rounds;
+      result.evaluations += stats.rounds - stats.cache_hits;
+      result.signature = utils::HashCat(result.signature, mv.from);
+      result.signature = utils::HashCat(result.signature, mv.to);
+      result.signature = utils::HashCat(result.signature, mv.promote.value);
+      result.signature = utils::HashCat(result.signature, stats.max_depth);
+      result.signature = utils::HashCat(result.signature, stats.cumulative_depth);
+      ++result.num_positions;
+
+      if (verbose) {
+        *verbose << "Position " << result.num_positions << "/" << BENCH_FENS.size() << ": bestmove "
+                 << mv << ", seldepth " << stats.max_depth << std::endl;
+      }
+    }
+
+    agent.info = saved_info;
+    // Don't leave the bench positions in the cache for the searches that follow.
+    agent.clear_cache();
+    return result;
+  }
+
+  std::ostream& operator<<(std::ostream& os, const BenchResult& result) {
+    os << "Positions       : " << result.num_positions << " x " << result.playouts << " playouts\n";
+    os << "Total time (ms) : " << static_cast<long>(result.seconds * 1000) << "\n";
+    os << "Nodes searched  : " << result.nodes << "\n";
+    os << "Evaluations     : " << result.evaluations << "\n";
+    os << "Nodes/second    : " << static_cast<long>(result.nps()) << "\n";
+    os << "Signature       : " << std::hex << std::setw(16) << std::setfill('0') << result.signature
+       << std::dec << std::setfill(' ') << "\n";
+    if (result.hardware) {
+      os << "\n";
+      perf::write_report(os, *result.hardware, result.nodes, result.evaluations);
+    }
+    return os;
+  }
+
+  void BenchResult::write_json(const std::string& path) const {
+    std::ofstream fout(path, std::ios::out);
+    if (! fout)
+      throw std::runtime_error("unable to open file: " + path);
+    fout << "{\n";
+    fout << "  \"positions\": " << num_positions << ",\n";
+    fout << "  \"playouts\": " << playouts << ",\n";
+    fout << "  \"nodes\": " << nodes << ",\n";
+    fout << "  \"evaluations\": " << evaluations << ",\n";
+    fout << "  \"time_ms\": " << static_cast<long>(seconds * 1000) << ",\n";
+    fout << "  \"nps\": " << static_cast<long>(nps()) << ",\n";
+    if (hardware) {
+      fout << "  \"hardware\": {";
+      bool first = true;
+      for (int i=0; i<perf::NUM_COUNTERS; ++i) {
+        if (! hardware->open[i])
+          continue;
+        fout << (first ? "" : ", ") << "\"" << perf::COUNTER_NAMES[i] << "\": " << hardware->values[i];
+        first = false;
+      }
+      fout << "},\n";
+    }
+    // As a string, since JSON numbers don't hold 64 bit integers exactly
+    fout << "  \"signature\": \"" << std::hex << std::setw(16) << std::setfill('0') << signature << "\"\n";
+    fout << "}\n";
+  }
+
+};
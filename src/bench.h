@@ -0,0 +1,48 @@
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <cstdint>
+#include <optional>
+#include <ostream>
+#include <string>
+
+#include "zero/agent_zero.h"
+#include "perf_counters.h"
+
+namespace bench {
+
+  /// Default number of playouts per position.
+  constexpr int DEFAULT_PLAYOUTS = 400;
+
+  struct BenchResult {
+    int num_positions = 0;
+    int playouts = 0;
+    /// Playouts over all positions.
+    long nodes = 0;
+    /// Positions that were evaluated by the network, i.e., not found in the cache.
+    long evaluations = 0;
+    double seconds = 0.0;
+    /// Hash of the best moves and search depths, which changes when the search does.
+    uint64_t signature = 0;
+    /// Hardware counters over the searches, if enabled for the thread
+    std::optional<perf::Sample> hardware;
+
+    double nps() const { return static_cast<double>(nodes) / seconds; }
+
+    void write_json(const std::string& path) const;
+  };
+
+  std::ostream& operator<<(std::ostream&, const BenchResult&);
+
+  /// Search a fixed set of positions with a fixed number of playouts, without noise,
+  /// time management, early stops, Gumbel root selection or a tree memory limit,
+  /// starting from an empty cache.  The node count and signature are reproducible for a
+  /// given network, so nps can be compared between builds.  The agent's search settings
+  /// are restored and its cache is cleared afterwards.  With verbose, the best move of
+  /// each position is written to the stream.  If the hardware counters of the thread
+  /// are enabled, they are read around each search.
+  BenchResult run(zero::ZeroAgent& agent, int playouts, std::ostream* verbose = nullptr);
+
+};
+
+#endif // BENCH_H_
@@ -0,0 +1,233 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <span>
+#include <algorithm>
+
+#include <cxxopts.hpp>
+
+#include "chess/board.h"
+#include "zero/cached_inference.h"
+#include "zero/inference_options.h"
+#include "simulation.h"
+#include "utils.h"
+
+using namespace zero;
+
+
+namespace {
+
+  static_assert(sizeof(PolicyTensor) == PolicyTensor::size * sizeof(float),
+                "policies of a batch must be contiguous");
+
+  /// Positions from a file with one FEN per line.  Anything after a ';' is ignored, so
+  /// EPD files and the perft suite can be used.
+  std::vector<chess::Board> read_positions(const std::string& path) {
+    std::ifstream infile(path);
+    if (! infile)
+      throw std::runtime_error("unable to open file: " + path);
+    std::vector<chess::Board> positions;
+    std::string line;
+    while (std::getline(infile, line)) {
+      auto fen = line.substr(0, line.find(';'));
+      if (fen.find_first_not_of(" \t\r") == std::string::npos)
+        continue;
+      positions.emplace_back(fen);
+    }
+    if (positions.empty())
+      throw std::runtime_error("no positions in file: " + path);
+    return positions;
+  }
+
+  /// Timings of one configuration.  Latencies are per call, which is a batch for the
+  /// network and a single position for the cached model.
+  struct Timings {
+    std::vector<double> latencies;
+    double encode = 0.0;
+    double infer = 0.0;
+    double decode = 0.0;
+    int num_positions = 0;
+
+    void report(int num_threads, const std::string& batch) {
+      std::sort(latencies.begin(), latencies.end());
+      auto percentile = [&](double p) {
+        const auto i = std::min(latencies.size() - 1, static_cast<size_t>(p * static_cast<double>(latencies.size())));
+        return 1000.0 * latencies[i];
+      };
+      double total = 0.0;
+      for (auto t : latencies)
+        total += t;
+
+      std::cout << std::fixed << std::setw(7) << num_threads << std::setw(8) << batch;
+      std::cout << std::setprecision(3) << std::setw(10) << percentile(0.5) << std::setw(10) << percentile(0.99);
+      std::cout << std::setprecision(1) << std::setw(11) << num_positions / total;
+      if (infer > 0.0) {
+        std::cout << std::setw(9) << 100.0 * encode / total << std::setw(9) << 100.0 * infer / total
+                  << std::setw(9) << 100.0 * decode / total;
+      }
+      std::cout << std::endl;
+    }
+  };
+
+  /// Time the network directly, in batches: encode the positions, run the network, and
+  /// decode the priors of the legal moves from the policies.
+  Timings benchmark_model(InferenceModel& model, const Encoder& encoder,
+                          std::span<const chess::Board> positions, int batch_size, int num_warmup) {
+    std::vector<float> input(static_cast<size_t>(batch_size) * encoder.num_planes() * chess::GRID_SIZE * chess::GRID_SIZE);
+    std::vector<uint8_t> packed_input(static_cast<size_t>(batch_size) * encoder.packed_size());
+    std::vector<PolicyTensor> policies(batch_size);
+    std::vector<float> values(batch_size);
+    std::vector<int64_t> indices;
+    std::vector<float> priors;
+
+    Timings timings;
+    utils::Timer timer;
+    const auto num_batches = static_cast<int>(positions.size()) / batch_size;
+    for (int i=0; i<num_batches; ++i) {
+      const auto batch = positions.subspan(static_cast<size_t>(i) * batch_size, batch_size);
+
+      timer.reset();
+      if (model.packed_input())
+        encoder.encode_packed_batch(batch, packed_input.data());
+      else
+        encoder.encode_batch(batch, input.data());
+      const auto encode = timer.elapsed();
+
+      timer.reset();
+      if (model.packed_input())
+        model(packed_input.data(), encoder.packed_size(), batch_size, policies[0].data.data(), values.data());
+      else
+        model(input.data(), encoder.num_planes(), batch_size, policies[0].data.data(), values.data());
+      const auto infer = timer.elapsed();
+
+      timer.reset();
+      for (size_t j=0; j<batch.size(); ++j) {
+        indices.clear();
+        for (const auto& [mv, coords] : encoder.decode_legal_moves(batch[j]))
+          indices.push_back(PolicyTensor::index(coords[0], coords[1], coords[2]));
+        legal_move_softmax(policies[j], indices, 1.0, priors);
+      }
+      const auto decode = timer.elapsed();
+
+      if (i * batch_size < num_warmup)
+        continue;
+      timings.latencies.push_back(encode + infer + decode);
+      timings.encode += encode;
+      timings.infer += infer;
+      timings.decode += decode;
+      timings.num_positions += batch_size;
+    }
+    return timings;
+  }
+
+  /// Time the cached model used by the search, with the cache disabled.
+  Timings benchmark_cached_model(const std::shared_ptr<InferenceModel>& model,
+                                 const std::shared_ptr<Encoder>& encoder,
+                                 std::span<const chess::Board> positions, int num_warmup) {
+    CachedInferenceModel cached_model(model, encoder, 0, 1.0, true);
+    Timings timings;
+    utils::Timer timer;
+    bool cache_hit;
+    for (size_t i=0; i<positions.size(); ++i) {
+      timer.reset();
+      cached_model(positions[i], cache_hit);
+      const auto latency = timer.elapsed();
+      if (i < static_cast<size_t>(num_warmup))
+        continue;
+      timings.latencies.push_back(latency);
+      ++timings.num_positions;
+    }
+    return timings;
+  }
+
+};
+
+
+int main(int argc, const char* argv[]) {
+
+  cxxopts::Options options("benchmark-inference", "Benchmark network inference on encoded positions");
+
+  options.add_options()
+    ("network", "Path to network file", cxxopts::value<std::string>())
+    ("p,positions", "File with one FEN per line (default: random playouts)", cxxopts::value<std::string>())
+    ("n,num-positions", "Number of timed positions per configuration", cxxopts::value<int>()->default_value("2000"))
+    ("w,warmup", "Number of untimed positions per configuration", cxxopts::value<int>()->default_value("200"))
+    ("b,batch-sizes", "Comma separated batch sizes", cxxopts::value<std::vector<int>>()->default_value("1,8,32"))
+    ("t,num-threads", "Comma separated intra-op thread counts", cxxopts::value<std::vector<int>>()->default_value("1"))
+    ("inference-config", "Inference options file, e.g. written by autotune", cxxopts::value<std::string>())
+    ("encoding-version", "Version of network input encoding", cxxopts::value<int>()->default_value("2"))
+    ("seed", "Random seed for the sample positions", cxxopts::value<unsigned int>()->default_value("1"))
+    ("h,help", "Print usage")
+    ;
+
+  options.parse_positional({"network"});
+  options.positional_help("<network>");
+
+  cxxopts::ParseResult args;
+  try {
+    args = options.parse(argc, argv);
+  }
+  catch (const cxxopts::exceptions::exception& e) {
+    std::cout << options.help() << std::endl;
+    exit(1);
+  }
+
+  if (args.count("help")) {
+    std::cout << options.help() << std::endl;
+    exit(0);
+  }
+
+  if (! args.count("network")) {
+    std::cout << options.help() << std::endl;
+    exit(1);
+  }
+
+  const auto network_path = args["network"].as<std::string>();
+  const auto num_positions = args["num-positions"].as<int>();
+  const auto num_warmup = args["warmup"].as<int>();
+  const auto batch_sizes = args["batch-sizes"].as<std::vector<int>>();
+  const auto thread_counts = args["num-threads"].as<std::vector<int>>();
+  const auto encoding_version = args["encoding-version"].as<int>();
+
+  InferenceOptions inference_options;
+  if (args.count("inference-config"))
+    inference_options = InferenceOptions::load(args["inference-config"].as<std::string>());
+
+  auto encoder = std::make_shared<SimpleEncoder>(encoding_version);
+
+  std::vector<chess::Board> positions;
+  if (args.count("positions")) {
+    // Repeat the positions in the file as needed.
+    const auto file_positions = read_positions(args["positions"].as<std::string>());
+    for (int i=0; i<num_warmup + num_positions; ++i)
+      positions.push_back(file_positions[i % file_positions.size()]);
+  }
+  else
+    positions = random_positions(num_warmup + num_positions, args["seed"].as<unsigned int>());
+
+  // Latencies are per batch, and the shares are of the total time over encoding the
+  // input, running the network, and decoding the priors of the legal moves.
+  std::cout << std::setw(7) << "threads" << std::setw(8) << "batch" << std::setw(10) << "p50(ms)"
+            << std::setw(10) << "p99(ms)" << std::setw(11) << "pos/sec" << std::setw(9) << "encode%"
+            << std::setw(9) << "infer%" << std::setw(9) << "decode%" << std::endl;
+  for (int num_threads : thread_counts) {
+    inference_options.intra_threads = num_threads;
+    auto model = std::make_shared<InferenceModel>(network_path.c_str(), inference_options);
+
+    if (model->legal_move_output())
+      std::cout << "Network has the legal-move signature, only the cached model is timed" << std::endl;
+    else {
+      for (int batch_size : batch_sizes) {
+        if (batch_size > 1 && ! model->dynamic_batch()) {
+          std::cout << "Skipping batch size " << batch_size << ", network has a fixed batch size" << std::endl;
+          continue;
+        }
+        benchmark_model(*model, *encoder, positions, batch_size, num_warmup).report(num_threads, std::to_string(batch_size));
+      }
+    }
+
+    benchmark_cached_model(model, encoder, positions, num_warmup).report(num_threads, "cached");
+  }
+}
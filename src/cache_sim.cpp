@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+
+#include <cxxopts.hpp>
+
+#include "zero/cache_trace.h"
+
+using namespace zero;
+
+
+int main(int argc, const char* argv[]) {
+
+  cxxopts::Options options("cache-sim", "Replay network cache traces against cache sizes and eviction policies");
+
+  options.add_options()
+    ("traces", "Trace files written with --cache-trace", cxxopts::value<std::vector<std::string>>())
+    ("c,capacities", "Comma separated cache sizes", cxxopts::value<std::vector<size_t>>()->default_value("10000,30000,100000,300000,1000000,1600000"))
+    ("p,policies", "Comma separated eviction policies (fifo, lru, clock, 2q, generation, clock-generation)", cxxopts::value<std::vector<std::string>>()->default_value("fifo,lru,clock,2q,generation,clock-generation"))
+    ("csv", "Write comma separated values")
+    ("h,help", "Print usage")
+    ;
+
+  options.parse_positional({"traces"});
+  options.positional_help("<trace_file>...");
+
+  cxxopts::ParseResult args;
+  try {
+    args = options.parse(argc, argv);
+  }
+  catch (const cxxopts::exceptions::exception& e) {
+    std::cout << options.help() << std::endl;
+    exit(1);
+  }
+
+  if (args.count("help")) {
+    std::cout << options.help() << std::endl;
+    exit(0);
+  }
+
+  if (! args.count("traces")) {
+    std::cout << options.help() << std::endl;
+    exit(1);
+  }
+
+  const auto capacities = args["capacities"].as<std::vector<size_t>>();
+  const auto policies = args["policies"].as<std::vector<std::string>>();
+  const bool csv = args.count("csv");
+
+  // Traces are concatenated, each starting with an empty cache as a new process would.
+  std::vector<std::vector<uint64_t>> traces;
+  uint64_t num_lookups = 0;
+  uint64_t num_searches = 0;
+  for (const auto& path : args["traces"].as<std::vector<std::string>>()) {
+    traces.push_back(read_cache_trace(path));
+    for (auto record : traces.back()) {
+      if (record == CacheTraceWriter::SEARCH_MARKER)
+        ++num_searches;
+      else
+        ++num_lookups;
+    }
+  }
+  if (! csv)
+    std::cout << num_lookups << " lookups in " << num_searches << " searches\n\n";
+
+  // One row per capacity, with the hit rate of each policy in percent.
+  std::cout << (csv ? "capacity" : "   capacity");
+  auto width = [&](const std::string& name) {
+    return csv ? 0 : std::max(12, static_cast<int>(name.size()) + 2);
+  };
+  for (const auto& name : policies)
+    std::cout << (csv ? "," : "") << std::setw(width(name)) << name;
+  std::cout << std::endl;
+
+  for (auto capacity : capacities) {
+    std::cout << std::setw(csv ? 0 : 11) << capacity;
+    for (const auto& name : policies) {
+      cache_sim::Result total;
+      for (const auto& trace : traces) {
+        const auto policy = cache_sim::make_policy(name, capacity);
+        const auto result = cache_sim::simulate(trace, *policy);
+        total.lookups += result.lookups;
+        total.hits += result.hits;
+      }
+      std::cout << (csv ? "," : "") << std::fixed << std::setprecision(2) << std::setw(width(name))
+                << 100.0 * total.hit_rate();
+    }
+    std::cout << std::endl;
+  }
+}
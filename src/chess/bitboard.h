@@ -74,6 +74,15 @@ namespace chess {
 
   };
 
+  /// Shift bitboard by a signed number of squares, where positive is towards H8.
+  template <int Delta>
+  Bitboard shift(Bitboard bb) {
+    if constexpr (Delta > 0)
+      return bb << Delta;
+    else
+      return bb >> -Delta;
+  }
+
 };
 
 
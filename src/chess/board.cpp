@@ -149,6 +149,7 @@ namespace chess {
         bitboards[piece.value].set_bit(sq);
         bb_sides[static_cast<int>(color)].set_bit(sq);
         bb_sides[static_cast<int>(Color::both)].set_bit(sq);
+        material.add(piece);
       }
     }
   }
@@ -225,9 +226,14 @@ namespace chess {
         ++piece_count[static_cast<int>(piece.value)];
     }
 
-    for (auto piece_index=0; piece_index<NUM_PIECE_TYPES_BOTH; ++piece_index)
+    Material material_check;
+    for (auto piece_index=0; piece_index<NUM_PIECE_TYPES_BOTH; ++piece_index) {
       board_assert(piece_count[piece_index] == bitboards[piece_index].count(),
                    "piece count matches bitboard count");
+      for (int i=0; i<piece_count[piece_index]; ++i)
+        material_check.add(static_cast<Piece::Value>(piece_index));
+    }
+    board_assert(material == material_check, "material");
 
     // Check pawn bitboard squares:
     for (auto sq : bitboards[static_cast<int>(Piece::WP)])
@@ -258,135 +264,103 @@ namespace chess {
   }
 
   bool Board::square_attacked(Square sq, Color side) const {
+    if (side == Color::white)
+      return attacked_by<Color::white>(sq);
+    return attacked_by<Color::black>(sq);
+  }
+
+  /// Whether sq is attacked by side Them.
+  template <Color Them>
+  bool Board::attacked_by(Square sq) const {
     assert(check());
 
-    // Pawns
-    if (side == Color::white) {
-      if ((bitboards[static_cast<int>(Piece::WP)] & black_pawn_attacks[sq]).any())
-        return true;
-    }
-    else {
-      if ((bitboards[static_cast<int>(Piece::BP)] & white_pawn_attacks[sq]).any())
-        return true;
-    }
+    // Pawns: sq is attacked by a pawn on a square that a pawn of the other color on sq
+    // would attack.
+    const auto& pawn_attacks = (Them == Color::white ? black_pawn_attacks : white_pawn_attacks);
+    if ((bitboards[colored_piece(Piece::WP, Them).value] & pawn_attacks[sq]).any())
+      return true;
 
     // Knights
-    auto knight_piece = (side == Color::white ? Piece::WN : Piece::BN);
-    if ((knight_moves[sq] & bitboards[static_cast<int>(knight_piece)]).any())
+    if ((knight_moves[sq] & bitboards[colored_piece(Piece::WN, Them).value]).any())
       return true;
 
     auto occ = bb_sides[static_cast<int>(Color::both)];
+    const auto queens = bitboards[colored_piece(Piece::WQ, Them).value];
 
     // Bishops or queens
-    auto bishops_queens = (side == Color::white ?
-                           bitboards[static_cast<int>(Piece::WB)] | bitboards[static_cast<int>(Piece::WQ)] :
-                           bitboards[static_cast<int>(Piece::BB)] | bitboards[static_cast<int>(Piece::BQ)]);
+    auto bishops_queens = bitboards[colored_piece(Piece::WB, Them).value] | queens;
     if ((get_bishop_attacks(sq, occ) & bishops_queens).any())
       return true;
 
     // Rooks or queens
-    auto rooks_queens = (side == Color::white ?
-                           bitboards[static_cast<int>(Piece::WR)] | bitboards[static_cast<int>(Piece::WQ)] :
-                           bitboards[static_cast<int>(Piece::BR)] | bitboards[static_cast<int>(Piece::BQ)]);
+    auto rooks_queens = bitboards[colored_piece(Piece::WR, Them).value] | queens;
     if ((get_rook_attacks(sq, occ) & rooks_queens).any())
       return true;
 
     // Kings
-    auto king_piece = (side == Color::white ? Piece::WK : Piece::BK);
-    if ((king_moves[sq] & bitboards[static_cast<int>(king_piece)]).any())
+    if ((king_moves[sq] & bitboards[colored_piece(Piece::WK, Them).value]).any())
       return true;
 
     return false;
   }
 
-  int Board::repetition_count() const {
-    int repetitions = 0;
-    for (auto& item : history) {
-      if (item.hash == hash)
-        ++repetitions;
-    }
-    return repetitions;
-  }
+  template bool Board::attacked_by<Color::white>(Square sq) const;
+  template bool Board::attacked_by<Color::black>(Square sq) const;
 
   bool Board::is_draw_by_material() const {
-    if (bitboards[static_cast<int>(Piece::WP)].any() ||
-        bitboards[static_cast<int>(Piece::BP)].any())
-      return false;
-    if (bitboards[static_cast<int>(Piece::WQ)].any() ||
-        bitboards[static_cast<int>(Piece::BQ)].any() ||
-        bitboards[static_cast<int>(Piece::WR)].any() ||
-        bitboards[static_cast<int>(Piece::BR)].any())
-      return false;
-    if (bitboards[static_cast<int>(Piece::WB)].count() > 1 ||
-        bitboards[static_cast<int>(Piece::BB)].count() > 1)
-      return false;
-    if (bitboards[static_cast<int>(Piece::WN)].count() > 1 ||
-        bitboards[static_cast<int>(Piece::BN)].count() > 1)
-      return false;
-    if (bitboards[static_cast<int>(Piece::WN)].any() &&
-        bitboards[static_cast<int>(Piece::WB)].any())
-      return false;
-    if (bitboards[static_cast<int>(Piece::BN)].any() &&
-        bitboards[static_cast<int>(Piece::BB)].any())
-      return false;
-
-    // Otherwise, it must be a draw:
-    return true;
+    return material.is_insufficient();
   }
 
-  bool Board::is_over() const {
+  GameStatus Board::game_status() const {
+    if (status_ == GameStatus::unknown)
+      status_ = compute_game_status();
+    return status_;
+  }
+
+  GameStatus Board::compute_game_status() const {
     // This move count may not be exact (?)
     if (fifty_move > 100)
-      return true;
+      return GameStatus::fifty_move_draw;
     if (repetition_count() >= 2)
-      return true;
+      return GameStatus::repetition_draw;
     if (is_draw_by_material())
-      return true;
+      return GameStatus::material_draw;
 
     // Check for legal move:
-    auto board_copy = *this;
-    bool found = false;
     auto move_list = generate_all_moves();
     for (auto& mv : move_list.moves) {
-      if (! board_copy.make_move(mv))
-        continue;
-      found = true;
-      board_copy.undo_move();
-      break;
+      auto board_copy = *this;
+      if (board_copy.make_move(mv))
+        return GameStatus::ongoing;
     }
-    return ! found;
+
+    const bool in_check = square_attacked(king_sq[static_cast<int>(side)], other_side(side));
+    return in_check ? GameStatus::checkmate : GameStatus::stalemate;
   }
 
   std::optional<Color> Board::winner() const {
-    // This move count may not be exact (?)
-    if (fifty_move > 100)
-      return Color::both;
-    if (repetition_count() >= 2)
-      return Color::both;
-    if (is_draw_by_material())
+    switch (game_status()) {
+    case GameStatus::ongoing:
+      return std::nullopt;
+    case GameStatus::checkmate:
+      return other_side(side);
+    default:
+      // Stalemate or draw
       return Color::both;
-
-    // Check for legal move:
-    auto board_copy = *this;
-    bool found = false;
-    auto move_list = generate_all_moves();
-    for (auto& mv : move_list.moves) {
-      if (! board_copy.make_move(mv))
-        continue;
-      found = true;
-      board_copy.undo_move();
-      break;
     }
-    if (found)
-      return std::nullopt;
+  }
 
-    const bool in_check = square_attacked(king_sq[static_cast<int>(side)], other_side(side));
-    if (in_check) {
-      return other_side(side);
+  std::ostream& operator<<(std::ostream& os, GameStatus status) {
+    switch (status) {
+    case GameStatus::unknown: os << "unknown"; break;
+    case GameStatus::ongoing: os << "ongoing"; break;
+    case GameStatus::checkmate: os << "checkmate"; break;
+    case GameStatus::stalemate: os << "stalemate"; break;
+    case GameStatus::fifty_move_draw: os << "draw by fifty move rule"; break;
+    case GameStatus::repetition_draw: os << "draw by repetition"; break;
+    case GameStatus::material_draw: os << "draw by insufficient material"; break;
     }
-    else
-      // Stalemate
-      return Color::both;
+    return os;
   }
 
 };
@@ -6,10 +6,13 @@
 #include <bitset>
 #include <cstdint>
 #include <optional>
+#include <vector>
+#include <type_traits>
 
 #include "pieces.h"
 #include "bitboard.h"
 #include "hash.h"
+#include "material.h"
 #include "movegen.h"
 #include "game_moves.h"
 
@@ -29,16 +32,42 @@ namespace chess {
 
   extern const std::string_view START_FEN;
 
-  extern const Hasher hasher;
-
   struct Undo {
     Move mv;
     std::bitset<4> castle_perm;
     Square en_pas;
     int fifty_move;
+    int repetitions;
     uint64_t hash;
   };
 
+  /// Termination state of a position.  Draws carry the rule that caused them.
+  enum class GameStatus : uint8_t {
+    // Not yet computed.  Never returned by Board::game_status.
+    unknown,
+    ongoing,
+    checkmate,
+    stalemate,
+    fifty_move_draw,
+    repetition_draw,
+    material_draw,
+  };
+
+  std::ostream& operator<<(std::ostream& os, GameStatus status);
+
+  /// Stack of undo records for the moves that led to a position.
+  ///
+  /// This is kept outside of Board so that copying a board does not copy the game
+  /// history.  The hashes in the records are also what make_move uses to count
+  /// repetitions.
+  using History = std::vector<Undo>;
+
+  /// Position state.
+  ///
+  /// This is fixed-size and trivially copyable, so the cost of copying a board does not
+  /// depend on how far the game has gone.  Moves can either be made in place with a
+  /// History that allows them to be undone, or with copy-make, where a copy of the board
+  /// is made and the move is applied to the copy.
   class Board {
   public:
 
@@ -54,16 +83,16 @@ namespace chess {
     Square en_pas = Position::none;
     int fifty_move = 0;
     int total_moves = 0;
-
-      /* ply: u32, */
-      /* hist_ply: u32, */
-
-    std::vector<Undo> history;
+    // Number of times the current position occurred previously, based on the history
+    // passed to make_move.  This is maintained incrementally, so queries are O(1).
+    int repetitions = 0;
 
     std::bitset<4> castle_perm;
 
     uint64_t hash = 0;
 
+    Material material;
+
     Board(const std::string_view = START_FEN);
 
     friend std::ostream& operator<<(std::ostream&, const Board& b);
@@ -73,26 +102,57 @@ namespace chess {
     bool check() const;
 
     bool square_attacked(Square sq, Color side) const;
+    template <Color Them>
+    bool attacked_by(Square sq) const;
 
     MoveList generate_all_moves() const;
     std::vector<Move> generate_legal_moves() const;
-
-    bool is_over() const;
+    // Number of legal moves, found from the pins and checks on our king instead of
+    // making each move.
+    long count_legal_moves() const;
+
+    // Termination state, computed on first use and then cached on the board until the
+    // next move is made or undone.
+    GameStatus game_status() const;
+    bool is_over() const { return game_status() != GameStatus::ongoing; }
     std::optional<Color> winner() const;
-    int repetition_count() const;
+    int repetition_count() const { return repetitions; }
 
     // makemove
+    bool make_move(Move mv, History& history);
+    void undo_move(History& history);
+    // Copy-make: apply the move without recording undo information.  If the move is
+    // illegal, false is returned and the board is left in an invalid state, so this
+    // should be called on a copy that is discarded in that case.  Repetitions are not
+    // tracked, since no history is available.
     bool make_move(Move mv);
-    void undo_move();
+    // Push the undo record for making mv from this position, without making it.  This
+    // extends a history along a line of positions that were reached by copy-make.
+    void record_move(Move mv, History& history) const;
 
-    long perft(int depth);
+    long perft(int depth) const;
 
     // io
     std::optional<Move> parse_move_string(std::string_view str);
 
   private:
+    mutable GameStatus status_ = GameStatus::unknown;
+
     void update_lists_and_material();
     bool is_draw_by_material() const;
+    GameStatus compute_game_status() const;
+
+    // Color-templated implementations.  The public functions dispatch on side once, so
+    // that pawn directions, promotion ranks, castling squares, and piece types are
+    // compile-time constants.
+    template <Color Us>
+    MoveList generate_moves() const;
+    template <Color Us>
+    long do_count_legal_moves() const;
+    template <Color Us>
+    bool do_make_move(Move mv);
+    template <Color Us>
+    void do_undo_move(const Undo& undo);
 
     // makemove
     void hash_piece(Piece piece, Square sq);
@@ -102,9 +162,12 @@ namespace chess {
     void clear_piece(Square sq);
     void add_piece(Piece piece, Square sq);
     void move_piece(Square from, Square to);
+    void update_repetitions(const History& history);
 
   };
 
+  static_assert(std::is_trivially_copyable_v<Board>);
+
 };
 
 #endif // BOARD_H_
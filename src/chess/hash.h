@@ -18,6 +18,8 @@ namespace chess {
     std::array<std::array<uint64_t, BOARD_SQ_NUM>, NUM_PIECE_TYPES_BOTH + 1> piece_keys;
     uint64_t side_key;
     std::array<uint64_t, 16> castle_keys;
+    // Material keys, indexed by piece type and count of that piece type
+    std::array<std::array<uint64_t, 16>, NUM_PIECE_TYPES_BOTH> material_keys;
 
     Hasher() {
       /* std::cout << "Setting hash\n"; */
@@ -36,9 +38,15 @@ namespace chess {
 
       for (auto& castle_key : castle_keys)
         castle_key = dist(engine);
+
+      for (auto& row : material_keys)
+        for (auto& material_key : row)
+          material_key = dist(engine);
     }
   };
 
+  extern const Hasher hasher;
+
 };
 
 
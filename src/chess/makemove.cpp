@@ -1,4 +1,5 @@
 #include <cassert>
+#include <algorithm>
 #include "board.h"
 
 namespace chess {
@@ -38,6 +39,7 @@ namespace chess {
 
     hash_piece(piece, sq);
     pieces[sq] = Piece::none;
+    material.remove(piece);
 
     bitboards[piece.value].clear_bit(sq);
     bb_sides[static_cast<int>(color)].clear_bit(sq);
@@ -51,6 +53,7 @@ namespace chess {
 
     hash_piece(piece, sq);
     pieces[sq] = piece;
+    material.add(piece);
 
     bitboards[piece.value].set_bit(sq);
     bb_sides[static_cast<int>(color)].set_bit(sq);
@@ -75,31 +78,85 @@ namespace chess {
     bb_sides[static_cast<int>(Color::both)].set_bit(to);
   }
 
+  bool Board::make_move(Move mv, History& history) {
+    record_move(mv, history);
+
+    if (! make_move(mv)) {
+      undo_move(history);
+      return false;
+    }
+
+    update_repetitions(history);
+    return true;
+  }
+
+  /// Set the repetition count for the position just reached.
+  ///
+  /// Only positions since the last irreversible move (capture or pawn move), as given
+  /// by the fifty move count, and with the same side to move can repeat, so we step back
+  /// two plies at a time within that window.  The undo record for the position k plies
+  /// back is history[size - k], and it stores that position's own repetition count, so
+  /// the search can stop at the most recent match.
+  void Board::update_repetitions(const History& history) {
+    repetitions = 0;
+    const auto n = static_cast<int>(history.size());
+    const int window = std::min(fifty_move, n);
+    for (int k = 4; k <= window; k += 2) {
+      const auto& undo = history[n - k];
+      if (undo.hash == hash) {
+        repetitions = undo.repetitions + 1;
+        return;
+      }
+    }
+  }
+
+  void Board::record_move(Move mv, History& history) const {
+    history.emplace_back(mv, castle_perm, en_pas, fifty_move, repetitions, hash);
+  }
+
   bool Board::make_move(Move mv) {
+    if (side == Color::white)
+      return do_make_move<Color::white>(mv);
+    return do_make_move<Color::black>(mv);
+  }
+
+  void Board::undo_move(History& history) {
+    assert(check());
+
+    auto undo = history.back();
+    history.pop_back();
+
+    // The side that made the move is the one not on move now.
+    if (side == Color::black)
+      do_undo_move<Color::white>(undo);
+    else
+      do_undo_move<Color::black>(undo);
+  }
+
+  template <Color Us>
+  bool Board::do_make_move(Move mv) {
     assert(check());
+    assert(side == Us);
+
+    constexpr Color Them = other_side(Us);
+    constexpr bool white = (Us == Color::white);
+    constexpr int up = white ? 8 : -8;
+    // Squares on the back rank, relative to white's
+    constexpr int rank_offset = white ? 0 : Position::A8;
 
     auto from = mv.from;
     auto to = mv.to;
 
     assert(pieces[from].exists());
 
-    auto prev_hash = hash;
-
     if (mv.is_en_pas()) {
-      if (side == Color::white)
-        clear_piece(to - 8);
-      else
-        clear_piece(to + 8);
+      clear_piece(to - up);
     }
     else if (mv.is_castle()) {
-      if (to == Position::C1)
-        move_piece(Position::A1, Position::D1);
-      else if (to == Position::C8)
-        move_piece(Position::A8, Position::D8);
-      else if (to == Position::G1)
-        move_piece(Position::H1, Position::F1);
-      else if (to == Position::G8)
-        move_piece(Position::H8, Position::F8);
+      if (to == Position::C1 + rank_offset)
+        move_piece(Position::A1 + rank_offset, Position::D1 + rank_offset);
+      else if (to == Position::G1 + rank_offset)
+        move_piece(Position::H1 + rank_offset, Position::F1 + rank_offset);
       else
         throw std::runtime_error("invalid position in move with castle flag");
     }
@@ -109,8 +166,6 @@ namespace chess {
     // Hash out current state
     hash_castle();
 
-    history.emplace_back(mv, castle_perm, en_pas, fifty_move, prev_hash);
-
     castle_perm &= CASTLE_PERM[from];
     castle_perm &= CASTLE_PERM[to];
     en_pas = Position::none;
@@ -120,22 +175,19 @@ namespace chess {
 
     ++fifty_move;
     ++total_moves;
+    repetitions = 0;
+    status_ = GameStatus::unknown;
 
     if (mv.is_capture()) {
       clear_piece(to);
       fifty_move = 0;
     }
 
-    if (pieces[from].is_pawn()) {
+    if (pieces[from] == colored_piece(Piece::WP, Us)) {
       fifty_move = 0;
       if (mv.is_pawn_start()) {
-        if (side == Color::white) {
-          en_pas = from + 8;
-          assert(en_pas/8 == RANK_3);
-        } else {
-          en_pas = from - 8;
-          assert(en_pas/8 == RANK_6);
-        }
+        en_pas = from + up;
+        assert(en_pas/8 == (white ? RANK_3 : RANK_6));
         hash_en_pas();
       }
     }
@@ -148,28 +200,23 @@ namespace chess {
       add_piece(mv.promote, to);
     }
 
-    if (pieces[to].is_king())
-      king_sq[static_cast<int>(side)] = to;
+    if (pieces[to] == colored_piece(Piece::WK, Us))
+      king_sq[static_cast<int>(Us)] = to;
 
-    auto original_side = side;
-    side = other_side(side);
+    side = Them;
     hash_side();
 
     assert(check());
 
-    if (square_attacked(king_sq[static_cast<int>(original_side)], side)) {
-      undo_move();
-      return false;
-    }
-
-    return true;
+    return ! attacked_by<Them>(king_sq[static_cast<int>(Us)]);
   }
 
-  void Board::undo_move() {
-    assert(check());
+  template <Color Us>
+  void Board::do_undo_move(const Undo& undo) {
+    constexpr bool white = (Us == Color::white);
+    constexpr int up = white ? 8 : -8;
+    constexpr int rank_offset = white ? 0 : Position::A8;
 
-    auto undo = history.back();
-    history.pop_back();
     auto mv = undo.mv;
     auto from = mv.from;
     auto to = mv.to;
@@ -180,7 +227,9 @@ namespace chess {
 
     castle_perm = undo.castle_perm;
     fifty_move = undo.fifty_move;
+    repetitions = undo.repetitions;
     en_pas = undo.en_pas;
+    status_ = GameStatus::unknown;
 
     --total_moves;
 
@@ -188,32 +237,25 @@ namespace chess {
       hash_en_pas();
     hash_castle();
 
-    side = other_side(side);
+    side = Us;
     hash_side();
 
     if (mv.is_en_pas()) {
-      if (side == Color::white)
-        add_piece(Piece::BP, to - 8);
-      else
-        add_piece(Piece::WP, to + 8);
+      add_piece(colored_piece(Piece::WP, other_side(Us)), to - up);
     }
     else if (mv.is_castle()) {
-      if (to == Position::C1)
-        move_piece(Position::D1, Position::A1);
-      else if (to == Position::C8)
-        move_piece(Position::D8, Position::A8);
-      else if (to == Position::G1)
-        move_piece(Position::F1, Position::H1);
-      else if (to == Position::G8)
-        move_piece(Position::F8, Position::H8);
+      if (to == Position::C1 + rank_offset)
+        move_piece(Position::D1 + rank_offset, Position::A1 + rank_offset);
+      else if (to == Position::G1 + rank_offset)
+        move_piece(Position::F1 + rank_offset, Position::H1 + rank_offset);
       else
         throw std::runtime_error("invalid position in move with castle flag");
     }
 
     move_piece(to, from);
 
-    if (pieces[from].is_king())
-      king_sq[static_cast<int>(side)] = from;
+    if (pieces[from] == colored_piece(Piece::WK, Us))
+      king_sq[static_cast<int>(Us)] = from;
 
     if (mv.is_capture())
       add_piece(mv.capture, to);
@@ -221,7 +263,7 @@ namespace chess {
     if (mv.is_promotion()) {
         assert(mv.promote.exists() && ! mv.promote.is_pawn());
         clear_piece(from);
-        add_piece((mv.promote.color() == Color::white) ? Piece::WP : Piece::BP, from);
+        add_piece(colored_piece(Piece::WP, Us), from);
     }
 
     assert(check());
@@ -0,0 +1,43 @@
+#include <array>
+
+#include "material.h"
+
+namespace chess {
+
+  namespace {
+
+    constexpr uint64_t piece_bits(Piece piece, uint64_t bits) {
+      return bits << (Material::BITS_PER_PIECE * piece.value);
+    }
+
+    // Count bits that may be set when material is insufficient: kings, and at most one
+    // knight and one bishop per side.
+    constexpr uint64_t INSUFFICIENT_ALLOWED_BITS =
+      piece_bits(Piece::WK, 1) | piece_bits(Piece::BK, 1) |
+      piece_bits(Piece::WN, 1) | piece_bits(Piece::WB, 1) |
+      piece_bits(Piece::BN, 1) | piece_bits(Piece::BB, 1);
+
+    // Indexed by presence bits (WN, WB, BN, BB).  Material is insufficient unless one
+    // side has both a knight and a bishop.
+    constexpr std::array<bool, 16> INSUFFICIENT_TABLE = []() {
+      std::array<bool, 16> table {};
+      for (int i=0; i<16; ++i) {
+        const bool white_pair = (i & 0b0011) == 0b0011;
+        const bool black_pair = (i & 0b1100) == 0b1100;
+        table[i] = ! white_pair && ! black_pair;
+      }
+      return table;
+    }();
+
+  };
+
+  bool Material::is_insufficient() const {
+    if (counts & ~INSUFFICIENT_ALLOWED_BITS)
+      return false;
+
+    const auto index = (count(Piece::WN)) | (count(Piece::WB) << 1) |
+      (count(Piece::BN) << 2) | (count(Piece::BB) << 3);
+    return INSUFFICIENT_TABLE[index];
+  }
+
+};
@@ -0,0 +1,60 @@
+#ifndef MATERIAL_H
+#define MATERIAL_H
+
+#include <cstdint>
+#include <cassert>
+
+#include "pieces.h"
+#include "hash.h"
+
+namespace chess {
+
+  /// Material signature of a position, maintained incrementally as pieces are added to
+  /// and removed from the board.
+  ///
+  /// The count of each piece type is packed into 4 bits, so the packed value identifies
+  /// the material configuration exactly and can be used to classify endgames.  The
+  /// Zobrist material hash is better suited as a key for hash tables.
+  struct Material {
+    static constexpr int BITS_PER_PIECE = 4;
+
+    uint64_t counts = 0;
+    uint64_t hash = 0;
+
+    int count(Piece piece) const {
+      return static_cast<int>((counts >> (BITS_PER_PIECE * piece.value)) & 0xF);
+    }
+
+    void add(Piece piece) {
+      assert(count(piece) < 0xF);
+      hash ^= hasher.material_keys[piece.value][count(piece)];
+      counts += 1ULL << (BITS_PER_PIECE * piece.value);
+    }
+
+    void remove(Piece piece) {
+      assert(count(piece) > 0);
+      counts -= 1ULL << (BITS_PER_PIECE * piece.value);
+      hash ^= hasher.material_keys[piece.value][count(piece)];
+    }
+
+    /// Total number of pieces on the board, including kings and pawns.
+    int total() const {
+      // Add pairs of counts into bytes, then sum the bytes.
+      constexpr uint64_t low_nibbles = 0x0F0F0F0F0F0F0F0FULL;
+      const uint64_t byte_sums = (counts & low_nibbles) + ((counts >> 4) & low_nibbles);
+      return static_cast<int>((byte_sums * 0x0101010101010101ULL) >> 56);
+    }
+
+    bool has_pawns() const {
+      return count(Piece::WP) || count(Piece::BP);
+    }
+
+    /// Whether neither side has enough material to deliver checkmate.
+    bool is_insufficient() const;
+
+    bool operator==(const Material&) const = default;
+  };
+
+};
+
+#endif // MATERIAL_H
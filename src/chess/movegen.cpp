@@ -5,24 +5,18 @@
 #include "piece_moves.h"
 
 namespace chess {
-  constexpr std::array<Piece, 4> white_promotion_pieces {Piece::WN, Piece::WB, Piece::WR, Piece::WQ};
-  constexpr std::array<Piece, 4> black_promotion_pieces {Piece::BN, Piece::BB, Piece::BR, Piece::BQ};
 
-  void MoveList::add_white_pawn_move(Square from, Square to, Piece capture) {
-    if (from / 8 == RANK_7) {
-      // Add a version of the move with each possible promotion
-      for (auto promote : white_promotion_pieces) {
-        moves.emplace_back(from, to, capture, promote, MoveFlag::none);
-      }
-    }
-    else
-      moves.emplace_back(from, to, capture);
-  }
+  template <Color Us>
+  void MoveList::add_pawn_move(Square from, Square to, Piece capture) {
+    constexpr FileRank promotion_from_rank = (Us == Color::white ? RANK_7 : RANK_2);
+    constexpr std::array<Piece, 4> promotion_pieces {
+      colored_piece(Piece::WN, Us), colored_piece(Piece::WB, Us),
+      colored_piece(Piece::WR, Us), colored_piece(Piece::WQ, Us),
+    };
 
-  void MoveList::add_black_pawn_move(Square from, Square to, Piece capture) {
-    if (from / 8 == RANK_2) {
+    if (from / 8 == promotion_from_rank) {
       // Add a version of the move with each possible promotion
-      for (auto promote : black_promotion_pieces) {
+      for (auto promote : promotion_pieces) {
         moves.emplace_back(from, to, capture, promote, MoveFlag::none);
       }
     }
@@ -33,164 +27,203 @@ namespace chess {
 
 namespace chess {
   MoveList Board::generate_all_moves() const {
+    if (side == Color::white)
+      return generate_moves<Color::white>();
+    return generate_moves<Color::black>();
+  }
+
+  template <Color Us>
+  MoveList Board::generate_moves() const {
+    constexpr Color Them = other_side(Us);
+    constexpr bool white = (Us == Color::white);
+    // Pawn push and capture directions
+    constexpr int up = white ? 8 : -8;
+    constexpr int up_left = white ? 7 : -9;
+    constexpr int up_right = white ? 9 : -7;
+
     MoveList move_list;
     move_list.moves.reserve(128);
 
-    if (side == Color::white) {
-      // Pawn non-captures:
-      auto to_step1 = (bitboards[static_cast<int>(Piece::WP)] << 8) & (~ bb_sides[static_cast<int>(Color::both)]);
-      auto to_step2 = (to_step1 << 8) & BB_RANK_4 & (~ bb_sides[static_cast<int>(Color::both)]);
-
-      for (auto to64 : Bitboard(to_step1))
-        move_list.add_white_pawn_move(to64 - 8, to64, Piece::none);
-      for (auto to64 : Bitboard(to_step2))
-        move_list.moves.emplace_back(to64 - 2*8, to64, Piece::none, Piece::none, MoveFlag::pawnstart);
-
-      // Pawn captures:
-      auto to_cap_left = ((bitboards[static_cast<int>(Piece::WP)] & ~ BB_FILE_A) << 7) & bb_sides[static_cast<int>(Color::black)];
-      auto to_cap_right = ((bitboards[static_cast<int>(Piece::WP)] & ~ BB_FILE_H) << 9) & bb_sides[static_cast<int>(Color::black)];
-      for (auto to64 : Bitboard(to_cap_left))
-        move_list.add_white_pawn_move(to64 - 7, to64, pieces[to64]);
-      for (auto to64 : Bitboard(to_cap_right))
-        move_list.add_white_pawn_move(to64 - 9, to64, pieces[to64]);
-
-      // En passant captures:
-      if (en_pas != Position::none) {
-        auto ep_bb = Bitboard(1ULL << en_pas);
-        auto ep_to_left = ((bitboards[static_cast<int>(Piece::WP)] & ~ BB_FILE_A) << 7) & ep_bb;
-        auto ep_to_right = ((bitboards[static_cast<int>(Piece::WP)] & ~ BB_FILE_H) << 9) & ep_bb;
-
-        for (auto to64 : Bitboard(ep_to_left))
-          move_list.moves.emplace_back(to64 - 7, to64, Piece::none, Piece::none, MoveFlag::enpas);
-        for (auto to64 : Bitboard(ep_to_right))
-          move_list.moves.emplace_back(to64 - 9, to64, Piece::none, Piece::none, MoveFlag::enpas);
-      }
-
-      // Castling
-      if (castle_perm[castling::WK]) {
-        if (pieces[Position::F1] == Piece::none && pieces[Position::G1] == Piece::none) {
-          if ((! square_attacked(Position::E1, Color::black)) &&
-              (! square_attacked(Position::F1, Color::black)))
-            move_list.moves.emplace_back(Position::E1, Position::G1, Piece::none, Piece::none, MoveFlag::castle);
-        }
-      }
-      if (castle_perm[castling::WQ]) {
-        if (pieces[Position::D1] == Piece::none && pieces[Position::C1] == Piece::none && pieces[Position::B1] == Piece::none) {
-          if ((! square_attacked(Position::E1, Color::black)) &&
-              (! square_attacked(Position::D1, Color::black)))
-            move_list.moves.emplace_back(Position::E1, Position::C1, Piece::none, Piece::none, MoveFlag::castle);
-        }
-      }
+    const auto pawns = bitboards[colored_piece(Piece::WP, Us).value];
+    const auto occ = bb_sides[static_cast<int>(Color::both)];
+    const auto empty = Bitboard(~ occ);
+    const auto enemies = bb_sides[static_cast<int>(Them)];
+
+    // Pawn non-captures:
+    const auto double_push_rank = white ? BB_RANK_4 : BB_RANK_5;
+    auto to_step1 = shift<up>(pawns) & empty;
+    auto to_step2 = shift<up>(to_step1) & double_push_rank & empty;
+
+    for (auto to64 : Bitboard(to_step1))
+      move_list.add_pawn_move<Us>(to64 - up, to64, Piece::none);
+    for (auto to64 : Bitboard(to_step2))
+      move_list.moves.emplace_back(to64 - 2*up, to64, Piece::none, Piece::none, MoveFlag::pawnstart);
+
+    // Pawn captures:
+    auto to_cap_left = shift<up_left>(pawns & ~ BB_FILE_A) & enemies;
+    auto to_cap_right = shift<up_right>(pawns & ~ BB_FILE_H) & enemies;
+    for (auto to64 : Bitboard(to_cap_left))
+      move_list.add_pawn_move<Us>(to64 - up_left, to64, pieces[to64]);
+    for (auto to64 : Bitboard(to_cap_right))
+      move_list.add_pawn_move<Us>(to64 - up_right, to64, pieces[to64]);
+
+    // En passant captures:
+    if (en_pas != Position::none) {
+      auto ep_bb = Bitboard(1ULL << en_pas);
+      auto ep_to_left = shift<up_left>(pawns & ~ BB_FILE_A) & ep_bb;
+      auto ep_to_right = shift<up_right>(pawns & ~ BB_FILE_H) & ep_bb;
+
+      for (auto to64 : Bitboard(ep_to_left))
+        move_list.moves.emplace_back(to64 - up_left, to64, Piece::none, Piece::none, MoveFlag::enpas);
+      for (auto to64 : Bitboard(ep_to_right))
+        move_list.moves.emplace_back(to64 - up_right, to64, Piece::none, Piece::none, MoveFlag::enpas);
     }
-    else { // black
-
-      // Pawn non-captures:
-      auto to_step1 = (bitboards[static_cast<int>(Piece::BP)] >> 8) & (~ bb_sides[static_cast<int>(Color::both)]);
-      auto to_step2 = (to_step1 >> 8) & BB_RANK_5 & (~ bb_sides[static_cast<int>(Color::both)]);
-
-      for (auto to64 : Bitboard(to_step1))
-        move_list.add_black_pawn_move(to64 + 8, to64, Piece::none);
-      for (auto to64 : Bitboard(to_step2))
-        move_list.moves.emplace_back(to64 + 2*8, to64, Piece::none, Piece::none, MoveFlag::pawnstart);
-
-      // Pawn captures:
-      auto to_cap_left = ((bitboards[static_cast<int>(Piece::BP)] & ~ BB_FILE_A) >> 9) & bb_sides[static_cast<int>(Color::white)];
-      auto to_cap_right = ((bitboards[static_cast<int>(Piece::BP)] & ~ BB_FILE_H) >> 7) & bb_sides[static_cast<int>(Color::white)];
-      for (auto to64 : Bitboard(to_cap_left))
-        move_list.add_black_pawn_move(to64 + 9, to64, pieces[to64]);
-      for (auto to64 : Bitboard(to_cap_right))
-        move_list.add_black_pawn_move(to64 + 7, to64, pieces[to64]);
-
-      // En passant captures:
-      if (en_pas != Position::none) {
-        auto ep_bb = Bitboard(1ULL << en_pas);
-        auto ep_to_left = ((bitboards[static_cast<int>(Piece::BP)] & ~ BB_FILE_A) >> 9) & ep_bb;
-        auto ep_to_right = ((bitboards[static_cast<int>(Piece::BP)] & ~ BB_FILE_H) >> 7) & ep_bb;
-
-        for (auto to64 : Bitboard(ep_to_left))
-          move_list.moves.emplace_back(to64 + 9, to64, Piece::none, Piece::none, MoveFlag::enpas);
-        for (auto to64 : Bitboard(ep_to_right))
-          move_list.moves.emplace_back(to64 + 7, to64, Piece::none, Piece::none, MoveFlag::enpas);
-      }
 
-      // Castling
-      if (castle_perm[castling::BK]) {
-        if (pieces[Position::F8] == Piece::none && pieces[Position::G8] == Piece::none) {
-          if ((! square_attacked(Position::E8, Color::white)) &&
-              (! square_attacked(Position::F8, Color::white)))
-            move_list.moves.emplace_back(Position::E8, Position::G8, Piece::none, Piece::none, MoveFlag::castle);
-        }
+    // Castling
+    constexpr int king_side = white ? castling::WK : castling::BK;
+    constexpr int queen_side = white ? castling::WQ : castling::BQ;
+    // Squares on the back rank, relative to white's
+    constexpr int rank_offset = white ? 0 : Position::A8;
+    constexpr Square king_from = Position::E1 + rank_offset;
+
+    if (castle_perm[king_side]) {
+      if (pieces[Position::F1 + rank_offset] == Piece::none && pieces[Position::G1 + rank_offset] == Piece::none) {
+        if ((! attacked_by<Them>(king_from)) &&
+            (! attacked_by<Them>(Position::F1 + rank_offset)))
+          move_list.moves.emplace_back(king_from, Position::G1 + rank_offset, Piece::none, Piece::none, MoveFlag::castle);
       }
-      if (castle_perm[castling::BQ]) {
-        if (pieces[Position::D8] == Piece::none && pieces[Position::C8] == Piece::none && pieces[Position::B8] == Piece::none) {
-          if ((! square_attacked(Position::E8, Color::white)) &&
-              (! square_attacked(Position::D8, Color::white)))
-            move_list.moves.emplace_back(Position::E8, Position::C8, Piece::none, Piece::none, MoveFlag::castle);
-        }
+    }
+    if (castle_perm[queen_side]) {
+      if (pieces[Position::D1 + rank_offset] == Piece::none && pieces[Position::C1 + rank_offset] == Piece::none &&
+          pieces[Position::B1 + rank_offset] == Piece::none) {
+        if ((! attacked_by<Them>(king_from)) &&
+            (! attacked_by<Them>(Position::D1 + rank_offset)))
+          move_list.moves.emplace_back(king_from, Position::C1 + rank_offset, Piece::none, Piece::none, MoveFlag::castle);
       }
     }
 
+    // Piece moves, filtering out squares occupied by our own pieces
+    const auto targets = Bitboard(~ bb_sides[static_cast<int>(Us)]);
+    auto add_moves = [&](Square sq, Bitboard attacks) {
+      for (auto t_sq : Bitboard(attacks & targets))
+        move_list.moves.emplace_back(sq, t_sq, pieces[t_sq]);
+    };
+
     // Sliders
-    for (auto piece : sliders[static_cast<int>(side)]) {
-      for (auto sq : bitboards[piece.value]) {
-        Bitboard attacks;
-        switch (piece.value) {
-        case Piece::WR: case Piece::BR:
-          attacks = get_rook_attacks(sq, bb_sides[static_cast<int>(Color::both)]);
-          break;
-        case Piece::WB: case Piece::BB:
-          attacks = get_bishop_attacks(sq, bb_sides[static_cast<int>(Color::both)]);
-          break;
-        case Piece::WQ: case Piece::BQ:
-          attacks = get_queen_attacks(sq, bb_sides[static_cast<int>(Color::both)]);
-          break;
-        default:
-          throw std::runtime_error("unreachable");
-        }
-        attacks &= ~ bb_sides[static_cast<int>(side)];
-        for (auto t_sq : attacks) {
-          auto t_piece = pieces[t_sq];
-          move_list.moves.emplace_back(sq, t_sq, t_piece);
-        }
-      }
-    }
+    for (auto sq : bitboards[colored_piece(Piece::WB, Us).value])
+      add_moves(sq, get_bishop_attacks(sq, occ));
+    for (auto sq : bitboards[colored_piece(Piece::WR, Us).value])
+      add_moves(sq, get_rook_attacks(sq, occ));
+    for (auto sq : bitboards[colored_piece(Piece::WQ, Us).value])
+      add_moves(sq, get_queen_attacks(sq, occ));
 
     // Non-sliders
-    for (auto piece : non_sliders[static_cast<int>(side)]) {
-      for (auto sq : bitboards[piece.value]) {
-        auto bb = [=]() {
-          switch(piece.value) {
-          case Piece::WN: case Piece::BN:
-            return knight_moves[sq];
-          case Piece::WK: case Piece::BK:
-            return king_moves[sq];
-          default:
-            throw std::runtime_error("unreachable");
-          }
-        }();
-        // Take moves bitboard and filter out side's pieces
-        auto iterator = Bitboard(bb & ~ bb_sides[static_cast<int>(side)]);
-        for (auto t_sq : iterator) {
-          auto t_piece = pieces[t_sq];
-          move_list.moves.emplace_back(sq, t_sq, t_piece);
-        }
-      }
-    }
+    for (auto sq : bitboards[colored_piece(Piece::WN, Us).value])
+      add_moves(sq, knight_moves[sq]);
+    for (auto sq : bitboards[colored_piece(Piece::WK, Us).value])
+      add_moves(sq, king_moves[sq]);
 
     return move_list;
   }
 
   std::vector<Move> Board::generate_legal_moves() const {
     auto move_list = generate_all_moves();
-    auto board_copy = *this;
     std::vector<Move> moves;
     for (auto& mv : move_list.moves) {
-      if (! board_copy.make_move(mv))
-        continue;
-      moves.push_back(mv);
-      board_copy.undo_move();
+      auto board_copy = *this;
+      if (board_copy.make_move(mv))
+        moves.push_back(mv);
     }
     return moves;
   }
 
+  long Board::count_legal_moves() const {
+    if (side == Color::white)
+      return do_count_legal_moves<Color::white>();
+    return do_count_legal_moves<Color::black>();
+  }
+
+  template <Color Us>
+  long Board::do_count_legal_moves() const {
+    constexpr Color Them = other_side(Us);
+    const Square king = king_sq[static_cast<int>(Us)];
+    const auto us = bb_sides[static_cast<int>(Us)];
+    const auto occ = bb_sides[static_cast<int>(Color::both)];
+    const auto queens = bitboards[colored_piece(Piece::WQ, Them).value];
+    const auto bishops_queens = bitboards[colored_piece(Piece::WB, Them).value] | queens;
+    const auto rooks_queens = bitboards[colored_piece(Piece::WR, Them).value] | queens;
+    const auto sq_bb = [](Square sq) { return Bitboard(1ULL << sq); };
+
+    // Squares strictly between two squares on a line, given whether the line is a rank
+    // or file (rook) or a diagonal (bishop).
+    const auto between = [&](Square a, Square b, bool rook) {
+      return rook ? Bitboard(get_rook_attacks(a, sq_bb(b)) & get_rook_attacks(b, sq_bb(a)))
+                  : Bitboard(get_bishop_attacks(a, sq_bb(b)) & get_bishop_attacks(b, sq_bb(a)));
+    };
+
+    // Enemy sliders that attack the king, or would if one of our pieces moved off the
+    // line.  A piece of ours alone on such a line is pinned to it.
+    Bitboard checkers;
+    std::array<Bitboard, 64> pin_rays;
+    Bitboard pinned;
+    auto add_sliders = [&](Bitboard sliders, bool rook) {
+      for (auto sq : sliders) {
+        const auto line = between(king, sq, rook);
+        const auto blockers = Bitboard(line & occ);
+        if (blockers.none())
+          checkers.set_bit(sq);
+        else if (blockers.count() == 1 && (blockers & us).any()) {
+          const Square pinned_sq = *blockers.begin();
+          pinned.set_bit(pinned_sq);
+          pin_rays[pinned_sq] = line | sq_bb(sq);
+        }
+      }
+    };
+    add_sliders(Bitboard(get_rook_attacks(king, Bitboard()) & rooks_queens), true);
+    add_sliders(Bitboard(get_bishop_attacks(king, Bitboard()) & bishops_queens), false);
+
+    const auto& pawn_attacks = (Them == Color::white ? black_pawn_attacks : white_pawn_attacks);
+    checkers |= knight_moves[king] & bitboards[colored_piece(Piece::WN, Them).value];
+    checkers |= pawn_attacks[king] & bitboards[colored_piece(Piece::WP, Them).value];
+
+    // In check, other pieces must capture the checker or block a slider's check.
+    Bitboard evasions = Bitboard(~ 0ULL);
+    if (checkers.count() == 1) {
+      const Square checker = *checkers.begin();
+      evasions = checkers;
+      if ((rooks_queens & checkers).any() && (get_rook_attacks(king, Bitboard()) & checkers).any())
+        evasions |= between(king, checker, true);
+      else if ((bishops_queens & checkers).any() && (get_bishop_attacks(king, Bitboard()) & checkers).any())
+        evasions |= between(king, checker, false);
+    }
+
+    // Whether the king would be attacked on sq, with the king itself off the board so
+    // that it can't hide behind its own square from a slider.
+    const auto king_occ = Bitboard(occ & ~ sq_bb(king));
+    const auto king_attacked = [&](Square sq) {
+      return (pawn_attacks[sq] & bitboards[colored_piece(Piece::WP, Them).value]).any() ||
+        (knight_moves[sq] & bitboards[colored_piece(Piece::WN, Them).value]).any() ||
+        (king_moves[sq] & bitboards[colored_piece(Piece::WK, Them).value]).any() ||
+        (get_bishop_attacks(sq, king_occ) & bishops_queens).any() ||
+        (get_rook_attacks(sq, king_occ) & rooks_queens).any();
+    };
+
+    long count = 0;
+    const auto move_list = generate_moves<Us>();
+    for (const auto& mv : move_list.moves) {
+      if (mv.from == king) {
+        // Castling through check is already excluded by the generator.
+        count += ! king_attacked(mv.to);
+      } else if (mv.is_en_pas()) {
+        // En passant removes two pieces from a rank, which can expose the king in ways
+        // the pin rays don't cover, so it is rare enough to just make the move.
+        auto board_copy = *this;
+        count += board_copy.make_move(mv);
+      } else if (checkers.count() < 2) {
+        count += evasions.test(mv.to) && (! pinned.test(mv.from) || pin_rays[mv.from].test(mv.to));
+      }
+    }
+    return count;
+  }
+
 };
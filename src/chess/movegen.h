@@ -10,8 +10,8 @@ namespace chess {
   struct MoveList {
     std::vector<Move> moves;
 
-    void add_white_pawn_move(Square from, Square to, Piece capture);
-    void add_black_pawn_move(Square from, Square to, Piece capture);
+    template <Color Us>
+    void add_pawn_move(Square from, Square to, Piece capture);
   };
 };
 
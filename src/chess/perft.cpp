@@ -3,7 +3,7 @@
 #include "board.h"
 
 namespace chess {
-  long Board::perft(int depth) {
+  long Board::perft(int depth) const {
     assert(check());
 
     if (depth == 0)
@@ -15,15 +15,15 @@ namespace chess {
     long new_count;
     for (auto& mv : move_list.moves) {
       // std::cout << "trying " << mv << ": ";
-      auto legal = make_move(mv);
+      auto board_copy = *this;
+      auto legal = board_copy.make_move(mv);
       // std::cout << legal << std::endl;
       if (! legal)
         continue;
-      new_count = perft(depth - 1);
+      new_count = board_copy.perft(depth - 1);
       // if (depth == 2)
       //   std::cout << "depth(" << depth << "), move " << mv << ": " << new_count << std::endl;
       count += new_count;
-      undo_move();
     }
     
     return count;
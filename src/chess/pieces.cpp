@@ -2,17 +2,6 @@
 
 namespace chess {
 
-  Color other_side(Color side) {
-    switch(side) {
-    case Color::white:
-      return Color::black;
-    case Color::black:
-      return Color::white;
-    default:
-      return Color::both;
-    }
-  }
-
   std::ostream& operator<<(std::ostream& os, const Piece& piece) {
     switch (piece.value) {
     case Piece::WP: os << "P"; break;
@@ -3,6 +3,7 @@
 
 #include <iostream>
 #include <array>
+#include <cstdint>
 
 namespace chess {
 
@@ -12,7 +13,16 @@ namespace chess {
     both,
   };
 
-  Color other_side(Color);
+  constexpr Color other_side(Color side) {
+    switch(side) {
+    case Color::white:
+      return Color::black;
+    case Color::black:
+      return Color::white;
+    default:
+      return Color::both;
+    }
+  }
 
   constexpr int NUM_PIECE_TYPES_BOTH = 12;
 
@@ -24,7 +34,7 @@ namespace chess {
   /// increase memory due to the optional storing a bool and an enum.
   class Piece {
   public:
-    enum Value {
+    enum Value : uint8_t {
       WP, WN, WB, WR, WQ, WK,
       BP, BN, BB, BR, BQ, BK,
       none,
@@ -38,15 +48,12 @@ namespace chess {
 
     constexpr bool exists() const { return value != none; }
 
-    Color color() const {
-      switch(value) {
-      case WP: case WN: case WB: case WR: case WQ: case WK:
+    constexpr Color color() const {
+      if (value <= WK)
         return Color::white;
-      case BP: case BN: case BB: case BR: case BQ: case BK:
+      if (value <= BK)
         return Color::black;
-      default:
-        return Color::both;
-      }
+      return Color::both;
     }
 
     constexpr bool is_pawn() const {
@@ -87,6 +94,12 @@ namespace chess {
     Value value = none;
   };
 
+  /// Piece of the given color and the same type as white_piece.  Being constexpr, this
+  /// resolves at compile time in color-templated code.
+  constexpr Piece colored_piece(Piece::Value white_piece, Color color) {
+    return static_cast<Piece::Value>(white_piece + (color == Color::black ? Piece::BP : 0));
+  }
+
   // SLIDERS[color] produces an array that can be iterated through
   constexpr std::array<std::array<Piece, 3>, 2> sliders {{
       {Piece::WB, Piece::WR, Piece::WQ},
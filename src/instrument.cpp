@@ -0,0 +1,200 @@
+#include <algorithm>
+#include <cstdlib>
+#include <iomanip>
+#include <new>
+#include <sstream>
+
+#include "instrument.h"
+
+
+namespace instrument {
+
+  Counters Counters::operator-(const Counters& other) const {
+    Counters result;
+    for (int i=0; i<NUM_PHASES; ++i) {
+      result.calls[i] = calls[i] - other.calls[i];
+      result.nanoseconds[i] = nanoseconds[i] - other.nanoseconds[i];
+      result.hardware[i] = hardware[i] - other.hardware[i];
+    }
+    for (int i=0; i<NUM_EVENTS; ++i)
+      result.events[i] = events[i] - other.events[i];
+    for (int i=0; i<NUM_ALLOC_SLOTS; ++i) {
+      result.allocations[i] = allocations[i] - other.allocations[i];
+      result.allocated_bytes[i] = allocated_bytes[i] - other.allocated_bytes[i];
+    }
+    return result;
+  }
+
+  Counters& Counters::operator+=(const Counters& other) {
+    for (int i=0; i<NUM_PHASES; ++i) {
+      calls[i] += other.calls[i];
+      nanoseconds[i] += other.nanoseconds[i];
+      hardware[i] += other.hardware[i];
+    }
+    for (int i=0; i<NUM_EVENTS; ++i)
+      events[i] += other.events[i];
+    for (int i=0; i<NUM_ALLOC_SLOTS; ++i) {
+      allocations[i] += other.allocations[i];
+      allocated_bytes[i] += other.allocated_bytes[i];
+    }
+    return *this;
+  }
+
+  uint64_t Counters::total_nanoseconds() const {
+    uint64_t total = 0;
+    for (auto ns : nanoseconds)
+      total += ns;
+    return total;
+  }
+
+  uint64_t Counters::total_allocations() const {
+    uint64_t total = 0;
+    for (auto n : allocations)
+      total += n;
+    return total;
+  }
+
+  void Counters::write_uci_info(std::ostream& os) const {
+    const auto total = static_cast<double>(std::max<uint64_t>(total_nanoseconds(), 1));
+    const auto flags = os.flags();
+    os << std::fixed << std::setprecision(1);
+    for (int i=0; i<NUM_PHASES; ++i) {
+      os << "info string phase " << PHASE_NAMES[i] << " calls " << calls[i]
+         << " time " << static_cast<double>(nanoseconds[i]) / 1e6 << " ms"
+         << " (" << 100.0 * static_cast<double>(nanoseconds[i]) / total << "%)";
+      if (calls[i])
+        os << " " << static_cast<double>(nanoseconds[i]) / 1e3 / static_cast<double>(calls[i]) << " us/call";
+      os << "\n";
+    }
+    os << "info string events";
+    for (int i=0; i<NUM_EVENTS; ++i)
+      os << " " << EVENT_NAMES[i] << " " << events[i];
+    if (ALLOC_ENABLED) {
+      os << "\ninfo string allocations";
+      for (int i=0; i<NUM_ALLOC_SLOTS; ++i)
+        os << " " << (i < NUM_PHASES ? PHASE_NAMES[i] : "other") << " " << allocations[i];
+    }
+    os << std::endl;
+    os.flags(flags);
+  }
+
+  std::string Counters::summary() const {
+    const auto total = static_cast<double>(std::max<uint64_t>(total_nanoseconds(), 1));
+    std::ostringstream ss;
+    ss << std::fixed << std::setprecision(0);
+    for (int i=0; i<NUM_PHASES; ++i) {
+      if (i > 0)
+        ss << " ";
+      ss << PHASE_NAMES[i] << " " << 100.0 * static_cast<double>(nanoseconds[i]) / total << "%";
+    }
+    ss << ", " << events[static_cast<int>(Event::cache_eviction)] << " evictions";
+    if (ALLOC_ENABLED) {
+      const auto playouts = std::max<uint64_t>(events[static_cast<int>(Event::playout)], 1);
+      ss << std::setprecision(1) << ", " << static_cast<double>(total_allocations()) / static_cast<double>(playouts)
+         << " allocs/playout";
+    }
+    return ss.str();
+  }
+
+  void Counters::write_metrics(std::ostream& os) const {
+    for (int i=0; i<NUM_PHASES; ++i)
+      os << PHASE_NAMES[i] << " " << calls[i] << " " << nanoseconds[i] << "\n";
+    for (int i=0; i<NUM_EVENTS; ++i)
+      os << EVENT_NAMES[i] << " " << events[i] << "\n";
+    if (ALLOC_ENABLED) {
+      for (int i=0; i<NUM_ALLOC_SLOTS; ++i) {
+        os << "alloc_" << (i < NUM_PHASES ? PHASE_NAMES[i] : "other") << " " << allocations[i]
+           << " " << allocated_bytes[i] << "\n";
+      }
+    }
+  }
+
+  void Counters::write_hardware(std::ostream& os) const {
+    perf::Sample total;
+    for (const auto& sample : hardware)
+      total += sample;
+    const auto& open = total.open;
+    if (std::none_of(open.begin(), open.end(), [](bool b) { return b; }))
+      return;
+    const auto flags = os.flags();
+    os << std::setw(12) << std::left << "per call" << std::right;
+    for (int j=0; j<perf::NUM_COUNTERS; ++j) {
+      if (open[j])
+        os << std::setw(15) << perf::COUNTER_NAMES[j];
+    }
+    os << "\n" << std::fixed << std::setprecision(1);
+    for (int i=0; i<NUM_PHASES; ++i) {
+      os << std::setw(12) << std::left << PHASE_NAMES[i] << std::right;
+      const auto n = static_cast<double>(std::max<uint64_t>(calls[i], 1));
+      for (int j=0; j<perf::NUM_COUNTERS; ++j) {
+        if (open[j])
+          os << std::setw(15) << static_cast<double>(hardware[i].values[j]) / n;
+      }
+      os << "\n";
+    }
+    os.flags(flags);
+  }
+
+  void Counters::write_allocations(std::ostream& os) const {
+    const auto playouts = static_cast<double>(std::max<uint64_t>(events[static_cast<int>(Event::playout)], 1));
+    const auto flags = os.flags();
+    os << std::setw(12) << std::left << "allocations" << std::right << std::setw(12) << "count"
+       << std::setw(14) << "bytes" << std::setw(14) << "per playout" << std::setw(14) << "bytes/playout" << "\n";
+    os << std::fixed << std::setprecision(2);
+    uint64_t total_bytes = 0;
+    for (int i=0; i<=NUM_ALLOC_SLOTS; ++i) {
+      const bool total = i == NUM_ALLOC_SLOTS;
+      const auto n = total ? total_allocations() : allocations[i];
+      const auto bytes = total ? total_bytes : allocated_bytes[i];
+      if (! total)
+        total_bytes += bytes;
+      os << std::setw(12) << std::left << (total ? "total" : i < NUM_PHASES ? PHASE_NAMES[i] : "other")
+         << std::right << std::setw(12) << n << std::setw(14) << bytes
+         << std::setw(14) << static_cast<double>(n) / playouts
+         << std::setw(14) << static_cast<double>(bytes) / playouts << "\n";
+    }
+    os.flags(flags);
+  }
+
+};
+
+
+#ifdef DLCHESS_ALLOC_HOOKS
+
+// Replacements of the global allocation functions, which count each allocation for
+// the phase of the calling thread.  The nothrow and array forms of libstdc++ call
+// these.
+
+void* operator new(size_t size) {
+  instrument::count_allocation(size);
+  if (auto* p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+
+void* operator new(size_t size, std::align_val_t alignment) {
+  instrument::count_allocation(size);
+  const auto align = static_cast<size_t>(alignment);
+  // The size must be a nonzero multiple of the alignment for aligned_alloc.
+  if (auto* p = std::aligned_alloc(align, (std::max<size_t>(size, 1) + align - 1) / align * align))
+    return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+
+#endif
@@ -0,0 +1,168 @@
+#ifndef INSTRUMENT_H_
+#define INSTRUMENT_H_
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+#include "perf_counters.h"
+
+/// Search instrumentation: per-thread call counts and timers for the phases of a
+/// playout, and event counters.  This is compiled in with the INSTRUMENT CMake option.
+/// Otherwise ENABLED is false and the timers and counters compile to nothing.  If the
+/// thread's hardware counters are enabled (perf::enable_thread), they are also counted
+/// per phase, at the cost of two system calls per phase.
+///
+/// The ALLOC_HOOKS CMake option also replaces the global operator new, to count heap
+/// allocations and their bytes per phase.
+namespace instrument {
+
+#ifdef DLCHESS_INSTRUMENT
+  inline constexpr bool ENABLED = true;
+#else
+  inline constexpr bool ENABLED = false;
+#endif
+
+#ifdef DLCHESS_ALLOC_HOOKS
+  inline constexpr bool ALLOC_ENABLED = true;
+#else
+  inline constexpr bool ALLOC_ENABLED = false;
+#endif
+
+  enum class Phase {
+    selection,  // Descent from the root to the leaf
+    movegen,    // Legal moves and their policy coordinates for a new leaf
+    encoding,   // Network input
+    inference,  // Network evaluation
+    decoding,   // Priors of the legal moves from the policy, and the cache insert
+    backprop,   // Backup of the value to the root
+    node_alloc, // Node creation, including its termination check
+  };
+  inline constexpr int NUM_PHASES = 7;
+  inline constexpr std::array<const char*, NUM_PHASES> PHASE_NAMES = {
+    "selection", "movegen", "encoding", "inference", "decoding", "backprop", "node_alloc",
+  };
+
+  enum class Event {
+    playout,
+    cache_hit,
+    cache_miss,
+    cache_eviction,
+  };
+  inline constexpr int NUM_EVENTS = 4;
+
+  /// Allocations are counted per phase, and in a last slot outside of any phase.
+  inline constexpr int NUM_ALLOC_SLOTS = NUM_PHASES + 1;
+  inline constexpr std::array<const char*, NUM_EVENTS> EVENT_NAMES = {
+    "playouts", "cache_hits", "cache_misses", "cache_evictions",
+  };
+
+  struct Counters {
+    std::array<uint64_t, NUM_PHASES> calls {};
+    std::array<uint64_t, NUM_PHASES> nanoseconds {};
+    std::array<uint64_t, NUM_EVENTS> events {};
+    std::array<perf::Sample, NUM_PHASES> hardware {};
+    std::array<uint64_t, NUM_ALLOC_SLOTS> allocations {};
+    std::array<uint64_t, NUM_ALLOC_SLOTS> allocated_bytes {};
+
+    /// Counts since an earlier snapshot.
+    Counters operator-(const Counters&) const;
+    Counters& operator+=(const Counters&);
+
+    uint64_t total_nanoseconds() const;
+    uint64_t total_allocations() const;
+
+    /// One "info string" line per phase with calls and time, and one for the events.
+    void write_uci_info(std::ostream&) const;
+    /// Compact percentage of time per phase, for progress lines.
+    std::string summary() const;
+    /// "name calls nanoseconds" per phase, then "name count" per event.
+    void write_metrics(std::ostream&) const;
+    /// Hardware counters per call of each phase, if any were counted.
+    void write_hardware(std::ostream&) const;
+    /// Allocations and bytes per phase, in total and per playout.
+    void write_allocations(std::ostream&) const;
+  };
+
+  /// Counters of the calling thread.
+  inline thread_local Counters thread_counters;
+
+  /// Phase of the calling thread, or NUM_PHASES outside of any phase.
+  inline thread_local int current_phase = NUM_PHASES;
+
+  /// Called by the operator new hook.
+  inline void count_allocation(size_t bytes) {
+    ++thread_counters.allocations[current_phase];
+    thread_counters.allocated_bytes[current_phase] += bytes;
+  }
+
+  /// Allocations of the calling thread from construction, for checking that a path
+  /// does not allocate.  Counts are zero unless ALLOC_ENABLED.
+  class AllocationCounter {
+  public:
+    AllocationCounter() : start_(thread_counters) {}
+
+    uint64_t allocations() const {
+      return (thread_counters - start_).total_allocations();
+    }
+
+  private:
+    Counters start_;
+  };
+
+  inline void count(Event event, uint64_t n = 1) {
+    if constexpr (ENABLED)
+      thread_counters.events[static_cast<int>(event)] += n;
+  }
+
+  /// Adds the time from construction to destruction to a phase.
+  class PhaseTimer {
+  public:
+    explicit PhaseTimer(Phase phase) {
+      if constexpr (ENABLED) {
+        phase_ = static_cast<int>(phase);
+        previous_phase_ = current_phase;
+        current_phase = phase_;
+        group_ = perf::thread_group();
+        if (group_)
+          start_sample_ = group_->read();
+        start_ = clock_::now();
+      }
+    }
+
+    ~PhaseTimer() {
+      stop();
+    }
+
+    /// End the phase before the end of the scope.
+    void stop() {
+      if constexpr (ENABLED) {
+        if (phase_ < 0)
+          return;
+        const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock_::now() - start_);
+        thread_counters.nanoseconds[phase_] += elapsed.count();
+        ++thread_counters.calls[phase_];
+        if (group_)
+          thread_counters.hardware[phase_] += group_->read() - start_sample_;
+        current_phase = previous_phase_;
+        phase_ = -1;
+      }
+    }
+
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+  private:
+    using clock_ = std::chrono::steady_clock;
+    int phase_;
+    int previous_phase_;
+    clock_::time_point start_;
+    const perf::CounterGroup* group_;
+    perf::Sample start_sample_;
+  };
+
+};
+
+#endif // INSTRUMENT_H_
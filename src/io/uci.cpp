@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 #include <thread>
 #include <atomic>
@@ -6,6 +7,7 @@
 #include "../version.h"
 #include "../chess/board.h"
 #include "../utils.h"
+#include "../bench.h"
 
 using chess::Color;
 
@@ -26,17 +28,38 @@ namespace {
     }
   }
 
-  void uci_ok() {
+  void uci_ok(const zero::SearchInfo& info, const zero::InferenceOptions& inference_options) {
     std::cout << "id name " << version::PROGRAM_NAME << std::endl;
     std::cout << "id author John McFarland" << std::endl;
 
     std::cout << "option name playouts type spin default 800 min 1 max 100000" << std::endl;
     std::cout << "option name noise type check default false" << std::endl;
+    std::cout << "option name tree_memory_mb type spin default " << (info.tree_memory_limit >> 20)
+              << " min 0 max 1048576" << std::endl;
+    std::cout << "option name tree_memory_action type combo default "
+              << (info.tree_memory_action == zero::TreeMemoryAction::stop ? "stop" : "prune")
+              << " var stop var prune" << std::endl;
+    std::cout << "option name smart_pruning_factor type string default " << info.smart_pruning_factor << std::endl;
+
+    std::cout << "option name provider type combo default " << inference_options.provider;
+    for (const auto& provider : zero::available_providers())
+      std::cout << " var " << provider;
+    std::cout << std::endl;
+    std::cout << "option name optimization type combo default " << inference_options.optimization
+              << " var disable var basic var extended var all" << std::endl;
+    std::cout << "option name intra_threads type spin default " << inference_options.intra_threads
+              << " min 0 max 256" << std::endl;
+    std::cout << "option name inter_threads type spin default " << inference_options.inter_threads
+              << " min 0 max 256" << std::endl;
+    std::cout << std::boolalpha;
+    std::cout << "option name parallel type check default " << inference_options.parallel << std::endl;
+    std::cout << std::noboolalpha;
+    std::cout << "option name inference_config type string default <empty>" << std::endl;
 
     std::cout << "uciok" << std::endl;
   }
 
-  void parse_go(std::string& line, const chess::Board& b, Agent* agent) {
+  void parse_go(std::string& line, const chess::Board& b, const chess::History& history, Agent* agent) {
     std::optional<int> move_time_ms;
     std::optional<int> time_left_ms;
     std::optional<int> inc_ms;
@@ -63,14 +86,26 @@ namespace {
       // else if (words[i] == "depth") {
       // }
     }
+
+    // There is nothing to search if there are no legal moves.
+    auto status = b.game_status();
+    if (status == chess::GameStatus::checkmate || status == chess::GameStatus::stalemate) {
+      std::cout << "info string " << status << std::endl;
+      std::cout << "bestmove 0000" << std::endl;
+      return;
+    }
+
     agent->set_search_time(move_time_ms, time_left_ms, inc_ms, b);
     agent->set_search_nodes(nodes);
-    auto mv = agent->select_move(b);
+    auto mv = agent->select_move(b, history);
     std::cout << "bestmove " << mv << std::endl;
   }
 
-  chess::Board parse_pos(std::string_view line) {
+  /// Parse the position command, returning the board and filling history with the moves
+  /// that led to it.
+  chess::Board parse_pos(std::string_view line, chess::History& history) {
     auto slice = line.substr(9);
+    history.clear();
 
     chess::Board b = [&]() {
       if (slice.starts_with("startpos"))
@@ -91,7 +126,7 @@ namespace {
       for (auto& word : words) {
         auto mv = b.parse_move_string(word);
         if (mv)
-          b.make_move(mv.value());
+          b.make_move(mv.value(), history);
         else
           break;
       }
@@ -102,8 +137,10 @@ namespace {
     return b;
   }
 
-  /// Parse command of form "setoption name <name> value <value>".
-  void parse_setoption(const std::string& line, zero::ZeroAgent* agent) {
+  /// Parse command of form "setoption name <name> value <value>".  Inference options are
+  /// only recorded, and take effect when the network is reloaded.
+  void parse_setoption(const std::string& line, zero::ZeroAgent* agent,
+                       zero::InferenceOptions& inference_options) {
     auto words = utils::split_string(line, ' ');
     if (words.size() < 5)
       return;
@@ -118,13 +155,68 @@ namespace {
       else if (words[4] == "false")
         agent->info.add_noise = false;
     }
+    else if (words[2] == "tree_memory_mb") {
+      try {
+        agent->info.tree_memory_limit = static_cast<size_t>(std::max(stoi(words[4]), 0)) << 20;
+      } catch (const std::invalid_argument& e) {} // NOLINT(bugprone-empty-catch)
+    }
+    else if (words[2] == "smart_pruning_factor") {
+      try {
+        agent->info.smart_pruning_factor = std::max(stof(words[4]), 0.0f);
+      } catch (const std::invalid_argument& e) {} // NOLINT(bugprone-empty-catch)
+    }
+    else if (words[2] == "tree_memory_action") {
+      try {
+        agent->info.tree_memory_action = zero::parse_tree_memory_action(words[4]);
+      } catch (const std::invalid_argument& e) {
+        std::cout << "info string " << e.what() << std::endl;
+      }
+    }
+    else {
+      try {
+        const auto previous = inference_options;
+        if (words[2] == "inference_config") {
+          // The path may contain spaces.
+          inference_options = zero::InferenceOptions::load(line.substr(line.find(" value ") + 7));
+          // The config file is written without regard to the global thread setting,
+          // which is a property of the process.
+          inference_options.global_threads = previous.global_threads;
+        }
+        else if (words[2] == "global_threads")
+          throw std::invalid_argument("global_threads can only be set on the command line");
+        else
+          inference_options.set(words[2], words[4]);
+      } catch (const std::exception& e) {
+        std::cout << "info string " << e.what() << std::endl;
+      }
+    }
+  }
+
+  /// Reload the network with new inference options.  The new model is created while the
+  /// current one is still loaded, and if that fails the current model and the previous
+  /// options are kept.  The global thread pools of the environment can't be replaced
+  /// while a session uses them, so they are only set on the command line.
+  void reload_model(zero::ZeroAgent* agent, const std::string& network_path,
+                    zero::InferenceOptions& inference_options,
+                    const zero::InferenceOptions& previous_options) {
+    std::shared_ptr<zero::InferenceModel> model;
+    try {
+      model = std::make_shared<zero::InferenceModel>(network_path.c_str(), inference_options);
+    } catch (const std::exception& e) {
+      std::cout << "info string " << e.what() << std::endl;
+      inference_options = previous_options;
+      return;
+    }
+    agent->set_model(model);
   }
 };
 
 namespace uci {
 
-  void uci_loop(zero::ZeroAgent* agent) {
+  void uci_loop(zero::ZeroAgent* agent, const std::string& network_path,
+                zero::InferenceOptions inference_options) {
     auto b = chess::Board();
+    chess::History history;
 
     utils::SyncQueue<std::string> sync_queue;
     auto stop_flag_ptr = std::make_shared<std::atomic<bool>>();
@@ -135,7 +227,11 @@ namespace uci {
     agent->info.game_mode = zero::GameMode::uci;
     agent->info.stop_flag_ptr_ = stop_flag_ptr;
 
-    uci_ok();
+    uci_ok(agent->info, inference_options);
+
+    // Options of the loaded network.  Changes from setoption are applied at the next
+    // isready or go, so that several options can be changed with a single reload.
+    auto loaded_options = inference_options;
 
     while (true) {
       *stop_flag_ptr = false;
@@ -143,18 +239,36 @@ namespace uci {
 
       sync_queue.get(input);
 
+      if ((input.starts_with("isready") || input.starts_with("go")) && inference_options != loaded_options) {
+        reload_model(agent, network_path, inference_options, loaded_options);
+        loaded_options = inference_options;
+      }
+
       if (input[0] == '\n')
         continue;
       else if (input.starts_with("isready"))
         std::cout << "readyok" << std::endl;
       else if (input.starts_with("position"))
-        b = parse_pos(input);
-      else if (input.starts_with("ucinewgame"))
-        b = parse_pos("position startpos\n");
+        b = parse_pos(input, history);
+      else if (input.starts_with("ucinewgame")) {
+        b = parse_pos("position startpos\n", history);
+        agent->info.saved_time_ms = 0.0;
+      }
       else if (input.starts_with("setoption"))
-        parse_setoption(input, agent);
+        parse_setoption(input, agent, inference_options);
       else if (input.starts_with("go"))
-        parse_go(input, b, agent);
+        parse_go(input, b, history, agent);
+      else if (input.starts_with("bench")) {
+        // Non-standard command: "bench [playouts]"
+        auto words = utils::split_string(input, ' ');
+        int playouts = bench::DEFAULT_PLAYOUTS;
+        try {
+          if (words.size() > 1)
+            playouts = std::stoi(words[1]);
+        } catch (const std::invalid_argument& e) {} // NOLINT(bugprone-empty-catch)
+        auto result = bench::run(*agent, playouts);
+        std::cout << result << std::flush;
+      }
       else if (input.starts_with("quit"))
         break;
     }
@@ -1,11 +1,16 @@
 #ifndef UCI_H_
 #define UCI_H_
 
+#include <string>
+
 #include "../zero/agent_zero.h"
 
 namespace uci {
 
-  void uci_loop(zero::ZeroAgent* agent);
+  /// Run the UCI protocol.  The network path and inference options are used to reload
+  /// the network when the inference options are changed with setoption.
+  void uci_loop(zero::ZeroAgent* agent, const std::string& network_path,
+                zero::InferenceOptions inference_options);
 
 };
 
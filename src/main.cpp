@@ -1,10 +1,15 @@
 #include <string>
 #include <iostream>
+#include <fstream>
 
 #include <cxxopts.hpp>
 
 #include "io/uci.h"
 #include "zero/agent_zero.h"
+#include "bench.h"
+#include "instrument.h"
+#include "trace.h"
+#include "perf_counters.h"
 
 int main(int argc, char* argv[]) {
 
@@ -12,6 +17,7 @@ int main(int argc, char* argv[]) {
 
   options.add_options()
     ("network", "Path to network file", cxxopts::value<std::string>())
+    ("command", "Optional command: bench", cxxopts::value<std::string>())
     // When set, this enables the "sticky_num_rounds" flag and overrides "go infinite"
     // commands.
     ("r,rounds", "Number of rounds (overrides \"go infinite\")", cxxopts::value<int>()->default_value("-1"))
@@ -23,20 +29,35 @@ int main(int argc, char* argv[]) {
     ("cpuct", "c_puct constant for UCT search", cxxopts::value<float>()->default_value("1.745"))
     ("cpuct-base", "c_puct base for growth", cxxopts::value<float>()->default_value("38739.0"))
     ("cpuct-factor", "c_puct multiplier for growth", cxxopts::value<float>()->default_value("3.894"))
+    ("tree-memory", "Limit on the search tree memory in MB (0 for no limit)", cxxopts::value<int>()->default_value("0"))
+    ("tree-memory-action", "At the tree memory limit: stop the search, or prune the least visited nodes", cxxopts::value<std::string>()->default_value("prune"))
+    ("smart-pruning", "Stop when the best move can't change in the playouts left, divided by this factor (0 to disable)", cxxopts::value<float>()->default_value("1.33"))
     ("fpu-value", "First play urgency value", cxxopts::value<float>()->default_value("0.33"))
     ("fpu-absolute", "Use FPU absolute strategy")
     // Note: Disabling bool must be done via --opt=false
     ("time-manager", "Use time manager", cxxopts::value<bool>()->default_value("true"))
     // Todo: should be able to parse input shape from onnx model and determine this automatically.
     ("encoding-version", "Version of network input encoding", cxxopts::value<int>()->default_value("2"))
-    ("t,num-threads", "Number of pytorch threads", cxxopts::value<int>())
+    ("inference-config", "Inference options file, e.g. written by autotune", cxxopts::value<std::string>())
+    ("provider", "Execution provider (cpu, xnnpack, dnnl)", cxxopts::value<std::string>())
+    ("optimization", "Graph optimization level (disable, basic, extended, all)", cxxopts::value<std::string>())
+    ("t,num-threads", "Number of intra-op inference threads", cxxopts::value<int>())
+    ("inter-threads", "Number of inter-op inference threads, with --parallel", cxxopts::value<int>())
+    ("parallel", "Run independent network operators in parallel")
+    ("global-threads", "Use inference thread pools shared by all sessions")
     ("d,debug", "Debug level", cxxopts::value<int>()->default_value("0"))
+    ("metrics", "Write search phase counters to this file on exit (needs -DINSTRUMENT=ON)", cxxopts::value<std::string>())
+    ("trace", "Write a timeline of the search to this JSON file on exit (needs -DTRACE=ON)", cxxopts::value<std::string>())
+    ("perf", "Count hardware events (cycles, instructions, cache and branch misses) in bench")
+    ("cache-trace", "Record the network cache lookups to this file, for cache-sim", cxxopts::value<std::string>())
+    ("bench-playouts", "Playouts per position for bench", cxxopts::value<int>()->default_value(std::to_string(bench::DEFAULT_PLAYOUTS)))
+    ("bench-json", "Also write the bench result to a JSON file", cxxopts::value<std::string>())
     ("h,help", "Print usage")
     ;
 
-  options.parse_positional({"network"});
+  options.parse_positional({"network", "command"});
 
-  options.positional_help("<network>");
+  options.positional_help("<network> [bench]");
 
   cxxopts::ParseResult args;
   try {
@@ -72,13 +93,23 @@ int main(int argc, char* argv[]) {
   auto encoding_version = args["encoding-version"].as<int>();
   auto debug = args["debug"].as<int>();
 
-  std::optional<int> num_threads_option;
+  zero::InferenceOptions inference_options;
+  if (args.count("inference-config"))
+    inference_options = zero::InferenceOptions::load(args["inference-config"].as<std::string>());
+  if (args.count("provider"))
+    inference_options.set("provider", args["provider"].as<std::string>());
+  if (args.count("optimization"))
+    inference_options.set("optimization", args["optimization"].as<std::string>());
   if (args.count("num-threads")) {
     std::cout << "setting " << args["num-threads"].as<int>() << " inference threads" << std::endl;
-    num_threads_option = args["num-threads"].as<int>();
+    inference_options.intra_threads = args["num-threads"].as<int>();
   }
-
-  auto model = std::make_shared<zero::InferenceModel>(args["network"].as<std::string>().c_str(), num_threads_option);
+  if (args.count("inter-threads"))
+    inference_options.inter_threads = args["inter-threads"].as<int>();
+  if (args.count("parallel"))
+    inference_options.parallel = true;
+  if (args.count("global-threads"))
+    inference_options.global_threads = true;
 
   auto encoder = std::make_shared<zero::SimpleEncoder>(encoding_version);
   zero::SearchInfo info;
@@ -96,16 +127,74 @@ int main(int argc, char* argv[]) {
   info.debug = debug;
   info.verbose_move_stats = verbose_move_stats;
   info.live_move_stats = live_move_stats;
+  info.tree_memory_limit = static_cast<size_t>(args["tree-memory"].as<int>()) << 20;
+  info.tree_memory_action = zero::parse_tree_memory_action(args["tree-memory-action"].as<std::string>());
+  info.smart_pruning_factor = args["smart-pruning"].as<float>();
   if (time_manager) {
     // auto the_time_manager = std::make_shared<AlphaZeroTimeManager>();
     auto the_time_manager = std::make_shared<SimpleTimeManager>();
     info.time_manager = the_time_manager;
   }
-  auto agent = std::make_unique<zero::ZeroAgent>(model, encoder, info);
+  // Open the hardware counters before the model starts its inference threads, so that
+  // the counters are inherited by them.
+  if (args.count("perf")) {
+    const auto& counters = perf::enable_thread();
+    if (! counters.available())
+      std::cerr << "Warning: hardware counters are not available (" << counters.error() << ")" << std::endl;
+  }
+  // The agent holds the only reference to the model, so that UCI can replace it.
+  auto agent = std::make_unique<zero::ZeroAgent>(
+    std::make_shared<zero::InferenceModel>(args["network"].as<std::string>().c_str(), inference_options),
+    encoder, info);
+  if (args.count("cache-trace"))
+    agent->set_cache_trace(std::make_shared<zero::CacheTraceWriter>(args["cache-trace"].as<std::string>()));
+
+  if (args.count("trace")) {
+    if (! trace::COMPILED)
+      std::cerr << "Warning: trace requested, but tracing is not compiled in (configure with -DTRACE=ON)" << std::endl;
+    trace::start();
+  }
+
+  if (args.count("command")) {
+    if (args["command"].as<std::string>() != "bench") {
+      std::cout << options.help() << std::endl;
+      exit(1);
+    }
+    const auto start_counters = instrument::thread_counters;
+    auto result = bench::run(*agent, args["bench-playouts"].as<int>(), &std::cout);
+    std::cout << "\n" << result;
+    const auto search_counters = instrument::thread_counters - start_counters;
+    if (instrument::ENABLED && perf::thread_group()) {
+      std::cout << "\n";
+      search_counters.write_hardware(std::cout);
+    }
+    if constexpr (instrument::ALLOC_ENABLED) {
+      std::cout << "\n";
+      search_counters.write_allocations(std::cout);
+    }
+    if (args.count("bench-json"))
+      result.write_json(args["bench-json"].as<std::string>());
+    if (args.count("trace") && trace::COMPILED) {
+      agent->wait_for_teardown();
+      trace::write_json(args["trace"].as<std::string>());
+    }
+    return 0;
+  }
 
   std::string input;
   std::cin >> input;
 
   if (input.rfind("uci", 0) == 0)
-    uci::uci_loop(agent.get());
+    uci::uci_loop(agent.get(), args["network"].as<std::string>(), inference_options);
+
+  if (args.count("metrics")) {
+    std::ofstream fout(args["metrics"].as<std::string>(), std::ios::out);
+    instrument::thread_counters.write_metrics(fout);
+  }
+
+  if (args.count("trace") && trace::COMPILED) {
+    // The reclaimer thread records events while it frees trees.
+    agent->wait_for_teardown();
+    trace::write_json(args["trace"].as<std::string>());
+  }
 }
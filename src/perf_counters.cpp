@@ -0,0 +1,165 @@
+#include <cerrno>
+#include <cstring>
+#include <iomanip>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "perf_counters.h"
+
+
+namespace {
+
+#ifdef __linux__
+
+  perf_event_attr counter_attr(perf::Counter counter) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // Count the threads created later too, such as the inference thread pools.  Group
+    // reads don't include those, so each counter is read on its own.
+    attr.inherit = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    switch (counter) {
+    case perf::Counter::cycles:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CPU_CYCLES;
+      break;
+    case perf::Counter::instructions:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+      break;
+    case perf::Counter::l1d_misses:
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+        | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      break;
+    case perf::Counter::llc_misses:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CACHE_MISSES;
+      break;
+    case perf::Counter::branch_misses:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+      break;
+    }
+    return attr;
+  }
+
+#endif
+
+};
+
+namespace perf {
+
+  Sample Sample::operator-(const Sample& other) const {
+    Sample result;
+    for (int i=0; i<NUM_COUNTERS; ++i)
+      result.values[i] = values[i] - other.values[i];
+    result.open = open;
+    return result;
+  }
+
+  Sample& Sample::operator+=(const Sample& other) {
+    for (int i=0; i<NUM_COUNTERS; ++i) {
+      values[i] += other.values[i];
+      open[i] = open[i] || other.open[i];
+    }
+    return *this;
+  }
+
+  CounterGroup::CounterGroup() {
+    fds_.fill(-1);
+#ifdef __linux__
+    for (int i=0; i<NUM_COUNTERS; ++i) {
+      auto attr = counter_attr(static_cast<Counter>(i));
+      // The group is enabled once all the counters are open.
+      attr.disabled = leader_fd_ < 0;
+      const auto fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader_fd_, 0));
+      if (fd < 0) {
+        if (error_.empty())
+          error_ = std::string(COUNTER_NAMES[i]) + ": " + std::strerror(errno);
+        continue;
+      }
+      if (leader_fd_ < 0)
+        leader_fd_ = fd;
+      fds_[i] = fd;
+      ++num_open_;
+    }
+    if (leader_fd_ >= 0) {
+      ioctl(leader_fd_, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl(leader_fd_, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#else
+    error_ = "hardware counters need Linux";
+#endif
+  }
+
+  CounterGroup::~CounterGroup() {
+#ifdef __linux__
+    for (auto fd : fds_) {
+      if (fd >= 0)
+        close(fd);
+    }
+#endif
+  }
+
+  Sample CounterGroup::read() const {
+    Sample sample;
+#ifdef __linux__
+    for (int i=0; i<NUM_COUNTERS; ++i) {
+      if (fds_[i] < 0)
+        continue;
+      // The count, time enabled and time running
+      std::array<uint64_t, 3> buffer {};
+      const auto size = static_cast<ssize_t>(sizeof(buffer));
+      if (::read(fds_[i], buffer.data(), size) != size)
+        continue;
+      auto value = buffer[0];
+      const auto enabled = buffer[1];
+      const auto running = buffer[2];
+      if (running > 0 && running < enabled)
+        value = static_cast<uint64_t>(static_cast<double>(value) * static_cast<double>(enabled) / static_cast<double>(running));
+      sample.values[i] = value;
+      sample.open[i] = true;
+    }
+#endif
+    return sample;
+  }
+
+  CounterGroup& enable_thread() {
+    if (! detail::thread_group)
+      detail::thread_group = std::make_unique<CounterGroup>();
+    return *detail::thread_group;
+  }
+
+  void write_report(std::ostream& os, const Sample& sample, long playouts, long evaluations) {
+    const auto flags = os.flags();
+    os << std::setw(16) << std::left << "Counter" << std::right << std::setw(16) << "total"
+       << std::setw(14) << "per playout" << std::setw(14) << "per eval" << "\n";
+    os << std::fixed << std::setprecision(1);
+    for (int i=0; i<NUM_COUNTERS; ++i) {
+      os << std::setw(16) << std::left << COUNTER_NAMES[i] << std::right;
+      if (! sample.open[i]) {
+        os << std::setw(16) << "n/a" << "\n";
+        continue;
+      }
+      const auto value = static_cast<double>(sample.values[i]);
+      os << std::setw(16) << sample.values[i];
+      os << std::setw(14) << (playouts ? value / static_cast<double>(playouts) : 0.0);
+      os << std::setw(14) << (evaluations ? value / static_cast<double>(evaluations) : 0.0) << "\n";
+    }
+    if (sample.has(Counter::cycles) && sample.has(Counter::instructions) && sample[Counter::cycles]) {
+      os << std::setprecision(2) << "Instructions per cycle: "
+         << static_cast<double>(sample[Counter::instructions]) / static_cast<double>(sample[Counter::cycles]) << "\n";
+    }
+    os.flags(flags);
+  }
+
+};
@@ -0,0 +1,94 @@
+#ifndef PERF_COUNTERS_H_
+#define PERF_COUNTERS_H_
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+
+/// Hardware performance counters of the calling thread and of the threads it starts
+/// after opening them, from perf_event_open on Linux.
+///
+/// The inherited threads include the ONNX Runtime thread pools, which do most of the
+/// work of a network evaluation, so the counters have to be opened before the model is
+/// created.  They also include the tree reclaimer thread of an agent.  The counters are
+/// opened as one group, so they are scheduled together, but inherited counters can't
+/// be read as a group, so each is read on its own.  Counters the CPU or kernel doesn't
+/// support are left out, and if the kernel multiplexes the group the counts are scaled
+/// up to the time enabled.  Access may need a lower /proc/sys/kernel/perf_event_paranoid.
+namespace perf {
+
+  enum class Counter {
+    cycles,
+    instructions,
+    l1d_misses,    // L1 data cache read misses
+    llc_misses,    // Last level cache misses
+    branch_misses,
+  };
+  inline constexpr int NUM_COUNTERS = 5;
+  inline constexpr std::array<const char*, NUM_COUNTERS> COUNTER_NAMES = {
+    "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses",
+  };
+
+  struct Sample {
+    std::array<uint64_t, NUM_COUNTERS> values {};
+    /// Whether each counter was read, as not all of them may be supported
+    std::array<bool, NUM_COUNTERS> open {};
+
+    uint64_t operator[](Counter counter) const { return values[static_cast<int>(counter)]; }
+    bool has(Counter counter) const { return open[static_cast<int>(counter)]; }
+
+    /// Counts since an earlier sample.
+    Sample operator-(const Sample&) const;
+    Sample& operator+=(const Sample&);
+  };
+
+  class CounterGroup {
+  public:
+    /// Open the counters for the calling thread and the threads it starts afterwards.
+    /// Only the calling thread should read them.  If none can be opened, available() is
+    /// false and error() says why.
+    CounterGroup();
+    ~CounterGroup();
+
+    CounterGroup(const CounterGroup&) = delete;
+    CounterGroup& operator=(const CounterGroup&) = delete;
+
+    bool available() const { return num_open_ > 0; }
+    bool has(Counter counter) const { return fds_[static_cast<int>(counter)] >= 0; }
+    const std::string& error() const { return error_; }
+
+    /// Counts since the group was opened.
+    Sample read() const;
+
+  private:
+    int leader_fd_ = -1;
+    /// File descriptor of each counter, or -1 if it isn't open
+    std::array<int, NUM_COUNTERS> fds_;
+    int num_open_ = 0;
+    std::string error_;
+  };
+
+  namespace detail {
+    inline thread_local std::unique_ptr<CounterGroup> thread_group;
+  };
+
+  /// Open the counters of the calling thread, if they aren't already.  Returns the
+  /// group, which may not be available().
+  CounterGroup& enable_thread();
+
+  /// Counters of the calling thread, or nullptr if they were not enabled or are not
+  /// available.
+  inline const CounterGroup* thread_group() {
+    const auto& group = detail::thread_group;
+    return group && group->available() ? group.get() : nullptr;
+  }
+
+  /// Counts in total, per playout and per network evaluation, and instructions per
+  /// cycle.  Counters that are not open are shown as n/a.
+  void write_report(std::ostream&, const Sample&, long playouts, long evaluations);
+
+};
+
+#endif // PERF_COUNTERS_H_
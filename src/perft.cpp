@@ -0,0 +1,225 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <memory>
+#include <bit>
+
+#include <cxxopts.hpp>
+
+#include "chess/board.h"
+#include "utils.h"
+
+using chess::Board;
+
+
+namespace {
+
+  /// Perft transposition table, keyed on (position hash, depth) and shared by all
+  /// threads.
+  ///
+  /// Entries are read and written without locking.  Each entry stores its data along
+  /// with the key XORed with the data, so an entry that was torn by a concurrent write
+  /// fails validation on lookup instead of producing a wrong count.
+  class PerftTable {
+    struct Entry {
+      std::atomic<uint64_t> check {0};
+      std::atomic<uint64_t> data {0};
+    };
+
+    // The depth is stored in the low bits of the data, and the count in the rest.
+    static constexpr int DEPTH_BITS = 8;
+    static constexpr uint64_t DEPTH_MASK = (1ULL << DEPTH_BITS) - 1;
+
+    std::unique_ptr<Entry[]> entries_; // NOLINT(modernize-avoid-c-arrays)
+    uint64_t mask_;
+
+  public:
+    PerftTable(size_t size_mb) {
+      // Round down to a power of two number of entries.
+      const size_t num_entries = std::bit_floor(std::max<size_t>(size_mb * 1024 * 1024 / sizeof(Entry), 1));
+      entries_ = std::make_unique<Entry[]>(num_entries); // NOLINT(modernize-avoid-c-arrays)
+      mask_ = num_entries - 1;
+    }
+
+    bool probe(uint64_t hash, int depth, long& count) const {
+      const auto& entry = entries_[hash & mask_];
+      const auto data = entry.data.load(std::memory_order_relaxed);
+      const auto check = entry.check.load(std::memory_order_relaxed);
+      if ((check ^ data) != hash || (data & DEPTH_MASK) != static_cast<uint64_t>(depth))
+        return false;
+      count = static_cast<long>(data >> DEPTH_BITS);
+      return true;
+    }
+
+    void store(uint64_t hash, int depth, long count) {
+      auto& entry = entries_[hash & mask_];
+      const auto data = (static_cast<uint64_t>(count) << DEPTH_BITS) | static_cast<uint64_t>(depth);
+      entry.data.store(data, std::memory_order_relaxed);
+      entry.check.store(hash ^ data, std::memory_order_relaxed);
+    }
+  };
+
+
+  long perft(const Board& b, int depth, PerftTable* table) {
+    if (depth == 0)
+      return 1;
+
+    long count = 0;
+    if (depth > 1 && table && table->probe(b.hash, depth, count))
+      return count;
+
+    // Bulk count the leaves: the legal moves are counted from the pins and checks on
+    // the king, without making them.
+    if (depth == 1)
+      return b.count_legal_moves();
+
+    auto move_list = b.generate_all_moves();
+    for (auto& mv : move_list.moves) {
+      auto board_copy = b;
+      if (board_copy.make_move(mv))
+        count += perft(board_copy, depth - 1, table);
+    }
+
+    if (table)
+      table->store(b.hash, depth, count);
+    return count;
+  }
+
+
+  /// Run perft with the legal root moves split across threads.
+  long parallel_perft(const Board& b, int depth, int num_threads, PerftTable* table) {
+    if (depth <= 1 || num_threads <= 1)
+      return perft(b, depth, table);
+
+    std::vector<Board> children;
+    for (auto& mv : b.generate_all_moves().moves) {
+      auto board_copy = b;
+      if (board_copy.make_move(mv))
+        children.push_back(board_copy);
+    }
+
+    std::atomic<size_t> next_child {0};
+    std::atomic<long> total {0};
+    auto worker = [&]() {
+      long count = 0;
+      for (size_t i; (i = next_child++) < children.size();)
+        count += perft(children[i], depth - 1, table);
+      total += count;
+    };
+
+    std::vector<std::thread> threads;
+    for (int i=0; i<num_threads; ++i)
+      threads.emplace_back(worker);
+    for (auto& thread : threads)
+      thread.join();
+
+    return total;
+  }
+
+};
+
+
+int main(int argc, const char* argv[]) {
+
+  cxxopts::Options options("perft", "Run move generator perft suite");
+
+  options.add_options()
+    ("suite", "Path to perft suite file", cxxopts::value<std::string>()->default_value("perftsuite.txt"))
+    ("fen", "Run a single position instead of the suite", cxxopts::value<std::string>())
+    ("d,max-depth", "Maximum depth", cxxopts::value<int>()->default_value("5"))
+    ("t,num-threads", "Number of threads", cxxopts::value<int>()->default_value(std::to_string(std::max(1u, std::thread::hardware_concurrency()))))
+    ("hash", "Transposition table size in MB (0 to disable)", cxxopts::value<int>()->default_value("64"))
+    ("v,verbosity", "Verbosity level", cxxopts::value<int>()->default_value("0"))
+    ("h,help", "Print usage")
+    ;
+
+  options.parse_positional({"suite"});
+  options.positional_help("[suite_file]");
+
+  cxxopts::ParseResult args;
+  try {
+    args = options.parse(argc, argv);
+  }
+  catch (const cxxopts::exceptions::exception& e) {
+    std::cout << options.help() << std::endl;
+    exit(1);
+  }
+
+  if (args.count("help")) {
+    std::cout << options.help() << std::endl;
+    exit(0);
+  }
+
+  auto max_depth = args["max-depth"].as<int>();
+  auto num_threads = args["num-threads"].as<int>();
+  auto hash_mb = args["hash"].as<int>();
+  auto verbosity = args["verbosity"].as<int>();
+
+  std::unique_ptr<PerftTable> table;
+  if (hash_mb > 0)
+    table = std::make_unique<PerftTable>(hash_mb);
+
+  long total_nodes = 0;
+  int num_failures = 0;
+  const utils::Timer timer;
+
+  if (args.count("fen")) {
+    auto b = Board(args["fen"].as<std::string>());
+    for (int depth=1; depth<=max_depth; ++depth) {
+      auto count = parallel_perft(b, depth, num_threads, table.get());
+      total_nodes += count;
+      std::cout << "Depth " << depth << ": " << count << std::endl;
+    }
+  }
+  else {
+    const auto suite_path = args["suite"].as<std::string>();
+    std::ifstream infile(suite_path);
+    if (! infile) {
+      std::cerr << "unable to open perft suite: " << suite_path << std::endl;
+      exit(1);
+    }
+
+    std::string line;
+    while (std::getline(infile, line)) {
+      auto items = utils::split_string(line, ';');
+      if (items.empty())
+        continue;
+      auto fen = items.front();
+      items.erase(items.begin());
+      auto b = Board(fen);
+
+      for (auto& entry : items) {
+        std::stringstream ss(entry);
+        ss.get(); // Remove the "D" character
+        int depth;
+        long expected;
+        ss >> depth >> expected;
+        if (depth > max_depth)
+          break;
+
+        auto count = parallel_perft(b, depth, num_threads, table.get());
+        total_nodes += count;
+        if (count != expected) {
+          ++num_failures;
+          std::cout << "FAIL: " << fen << " depth " << depth << ": " << count << " (expected " << expected << ")" << std::endl;
+        }
+        else if (verbosity >= 1)
+          std::cout << fen << " depth " << depth << ": " << count << std::endl;
+      }
+    }
+  }
+
+  auto duration = timer.elapsed();
+  std::cout << "Nodes: " << total_nodes << std::endl;
+  std::cout << "Time: " << std::fixed << std::setprecision(3) << duration << " s" << std::endl;
+  std::cout << "NPS: " << static_cast<long>(static_cast<double>(total_nodes) / duration) << std::endl;
+  if (num_failures) {
+    std::cout << num_failures << " failures" << std::endl;
+    exit(1);
+  }
+}
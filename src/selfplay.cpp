@@ -3,8 +3,10 @@
 #include <chrono>
 #include <thread>
 #include <string>
+#include <algorithm>
 #include <array>
 #include <filesystem>
+#include <fstream>
 
 #include <cxxopts.hpp>
 
@@ -12,6 +14,9 @@
 #include "zero/agent_zero.h"
 #include "simulation.h"
 #include "utils.h"
+#include "instrument.h"
+#include "trace.h"
+#include "perf_counters.h"
 
 using namespace zero;
 using namespace utils;
@@ -32,15 +37,31 @@ int main(int argc, const char* argv[]) {
     // Careful, this only works with --noise=false, and "--noise false" will not
     // work and will not raise an error.
     ("noise", "Include Dirichlet noise", cxxopts::value<bool>()->default_value("true"))
+    ("tree-memory", "Limit on the search tree memory in MB (0 for no limit)", cxxopts::value<int>()->default_value("0"))
+    ("tree-memory-action", "At the tree memory limit: stop the search, or prune the least visited nodes", cxxopts::value<std::string>()->default_value("prune"))
+    ("gumbel", "Select root moves by Gumbel AlphaZero sequential halving, for few rounds")
+    ("gumbel-moves", "Root moves considered by the Gumbel search", cxxopts::value<int>()->default_value("16"))
+    ("kld-gain", "Stop the search when the root visit distribution changes by less than this KL divergence per playout (0 to disable)", cxxopts::value<double>()->default_value("0"))
+    ("kld-gain-interval", "Playouts between KL divergence checks", cxxopts::value<int>()->default_value("100"))
     ("policy-softmax-temp", "Policy softmax temperature", cxxopts::value<float>()->default_value("1.0"))
     ("cpuct", "c_puct constant for UCT search", cxxopts::value<float>()->default_value("1.2"))
     ("e,save-every", "Interval at which to save experience", cxxopts::value<int>()->default_value("100"))
     // Todo: should be able to parse input shape from onnx model and determine this automatically.
     ("encoding-version", "Version of network input encoding", cxxopts::value<int>()->default_value("2"))
     ("cache-size", "Max num elements in network cache", cxxopts::value<int>()->default_value("100000"))
+    ("metrics", "Write search phase counters to this file after each game (needs -DINSTRUMENT=ON)", cxxopts::value<std::string>())
+    ("trace", "Write a timeline of the search to this JSON file on exit (needs -DTRACE=ON)", cxxopts::value<std::string>())
+    ("perf", "Count hardware events (cycles, instructions, cache and branch misses), reported per playout and per evaluation")
+    ("cache-trace", "Record the network cache lookups to this file, for cache-sim", cxxopts::value<std::string>())
     ("v,verbosity", "Verbosity level", cxxopts::value<int>()->default_value("0"))
     ("d,debug", "Debug level", cxxopts::value<int>()->default_value("0"))
-    ("t,num-threads", "Number of pytorch threads", cxxopts::value<int>())
+    ("inference-config", "Inference options file, e.g. written by autotune", cxxopts::value<std::string>())
+    ("provider", "Execution provider (cpu, xnnpack, dnnl)", cxxopts::value<std::string>())
+    ("optimization", "Graph optimization level (disable, basic, extended, all)", cxxopts::value<std::string>())
+    ("t,num-threads", "Number of intra-op inference threads", cxxopts::value<int>())
+    ("inter-threads", "Number of inter-op inference threads, with --parallel", cxxopts::value<int>())
+    ("parallel", "Run independent network operators in parallel")
+    ("global-threads", "Use inference thread pools shared by all sessions")
     ("h,help", "Print usage")
     ;
 
@@ -100,13 +121,32 @@ int main(int argc, const char* argv[]) {
     }
   }
     
-  std::optional<int> num_threads_option;
+  InferenceOptions inference_options;
+  if (args.count("inference-config"))
+    inference_options = InferenceOptions::load(args["inference-config"].as<std::string>());
+  if (args.count("provider"))
+    inference_options.set("provider", args["provider"].as<std::string>());
+  if (args.count("optimization"))
+    inference_options.set("optimization", args["optimization"].as<std::string>());
   if (args.count("num-threads")) {
     std::cout << "setting " << args["num-threads"].as<int>() << " inference threads" << std::endl;
-    num_threads_option = args["num-threads"].as<int>();
+    inference_options.intra_threads = args["num-threads"].as<int>();
   }
+  if (args.count("inter-threads"))
+    inference_options.inter_threads = args["inter-threads"].as<int>();
+  if (args.count("parallel"))
+    inference_options.parallel = true;
+  if (args.count("global-threads"))
+    inference_options.global_threads = true;
 
-  auto model = std::make_shared<InferenceModel>(args["network"].as<std::string>().c_str(), num_threads_option);
+  // Open the hardware counters before the model starts its inference threads, so that
+  // the counters are inherited by them.
+  if (args.count("perf")) {
+    const auto& counters = perf::enable_thread();
+    if (! counters.available())
+      std::cerr << "Warning: hardware counters are not available (" << counters.error() << ")" << std::endl;
+  }
+  auto model = std::make_shared<InferenceModel>(args["network"].as<std::string>().c_str(), inference_options);
 
   std::cout << "Model loaded\n";
 
@@ -118,15 +158,33 @@ int main(int argc, const char* argv[]) {
   info.cpuct = cpuct;
   info.fpu_value = 0.0;
   info.nn_cache_size = cache_size;
+  info.tree_memory_limit = static_cast<size_t>(args["tree-memory"].as<int>()) << 20;
+  info.tree_memory_action = parse_tree_memory_action(args["tree-memory-action"].as<std::string>());
+  info.gumbel = args["gumbel"].as<bool>();
+  info.gumbel_considered_moves = std::max(args["gumbel-moves"].as<int>(), 1);
+  info.kld_gain_threshold = args["kld-gain"].as<double>();
+  info.kld_gain_interval = std::max(args["kld-gain-interval"].as<int>(), 1);
   info.debug = debug;
 
   auto encoder = std::make_shared<SimpleEncoder>(encoding_version);
 
-  auto collector = std::make_shared<ExperienceCollector>();
+  auto collector = std::make_shared<ExperienceCollector>(encoder->num_planes());
 
   auto agent = std::make_unique<ZeroAgent>(model, encoder, info);
 
   agent->set_collector(collector);
+  if (args.count("cache-trace"))
+    agent->set_cache_trace(std::make_shared<CacheTraceWriter>(args["cache-trace"].as<std::string>()));
+
+  if (args.count("metrics") && ! instrument::ENABLED)
+    std::cerr << "Warning: metrics requested, but instrumentation is not compiled in (configure with -DINSTRUMENT=ON)" << std::endl;
+  if (args.count("trace")) {
+    if (! trace::COMPILED)
+      std::cerr << "Warning: trace requested, but tracing is not compiled in (configure with -DTRACE=ON)" << std::endl;
+    trace::start();
+  }
+  const auto* counters = perf::thread_group();
+  perf::Sample hardware;
 
   int num_white_wins = 0;
   int num_black_wins = 0;
@@ -136,7 +194,15 @@ int main(int argc, const char* argv[]) {
   auto cumulative_timer = Timer();
   for (int game_num=0; game_num < num_games; ++game_num) {
     auto timer = Timer();
-    auto [winner, num_moves] = simulate_game(agent.get(), agent.get(), verbosity, max_moves);
+    const auto game_start_counters = instrument::thread_counters;
+    const auto game_start_cache_stats = agent->cache_stats();
+    const auto game_start_sample = counters ? counters->read() : perf::Sample();
+    auto [winner, num_moves] = [&]() {
+      const trace::Scope scope("game");
+      return simulate_game(agent.get(), agent.get(), verbosity, max_moves);
+    }();
+    if (counters)
+      hardware += counters->read() - game_start_sample;
     auto duration = timer.elapsed();
     total_num_moves += num_moves;
     if (num_games <= 5) {
@@ -156,7 +222,19 @@ int main(int argc, const char* argv[]) {
     std::cout << ", " << total_num_moves / (game_num + 1) << " mpg";
     std::cout << std::defaultfloat << std::setprecision(4);
     std::cout << ", " << total_num_moves / total_duration << " mps";
-    std::cout << "  [" << format_seconds(total_duration) << " < " << format_seconds(remaining_sec) << "]" << std::endl;
+    std::cout << "  [" << format_seconds(total_duration) << " < " << format_seconds(remaining_sec) << "]";
+    const auto cache_stats = agent->cache_stats() - game_start_cache_stats;
+    std::cout << std::fixed << std::setprecision(1) << "  cache " << 100.0 * cache_stats.hit_rate() << "% hit "
+              << 100.0 * cache_stats.occupancy() << "% full " << cache_stats.evictions << " evicted";
+    std::cout << std::defaultfloat << std::setprecision(4);
+    if constexpr (instrument::ENABLED)
+      std::cout << "  {" << (instrument::thread_counters - game_start_counters).summary() << "}";
+    std::cout << std::endl;
+
+    if (args.count("metrics")) {
+      std::ofstream fout(args["metrics"].as<std::string>(), std::ios::out);
+      instrument::thread_counters.write_metrics(fout);
+    }
 
     auto white_reward = [=]() {
       if (winner == Color::white)
@@ -177,8 +255,27 @@ int main(int argc, const char* argv[]) {
   }
 
   std::cout << "Finished: " << total_num_moves << " moves at " << std::setprecision(2) << total_num_moves / cumulative_timer.elapsed() << " moves / second" << std::endl;
+  std::cout << "Peak RSS: " << std::fixed << std::setprecision(1) << peak_rss_mb() << " MB" << std::endl;
+  if (counters) {
+    std::cout << "\n";
+    perf::write_report(std::cout, hardware, agent->total_playouts(), agent->total_evaluations());
+    if constexpr (instrument::ENABLED) {
+      std::cout << "\n";
+      instrument::thread_counters.write_hardware(std::cout);
+    }
+  }
+  if constexpr (instrument::ALLOC_ENABLED) {
+    std::cout << "\n";
+    instrument::thread_counters.write_allocations(std::cout);
+  }
 
   if (store_experience) {
     collector->serialize_binary(output_path, experience_label);
   }
+
+  if (args.count("trace") && trace::COMPILED) {
+    // The reclaimer thread records events while it frees trees.
+    agent->wait_for_teardown();
+    trace::write_json(args["trace"].as<std::string>());
+  }
 }
@@ -2,6 +2,8 @@
 
 #include <iostream>
 #include <array>
+#include <random>
+#include <unordered_set>
 
 
 std::pair<chess::Color, int> simulate_game(Agent* white_agent,
@@ -12,16 +14,17 @@ std::pair<chess::Color, int> simulate_game(Agent* white_agent,
   int move_count = 0;
 
   auto b = chess::Board();
+  chess::History history;
 
   while (move_count < max_moves && ! b.is_over()) {
     if (verbosity >= 3)
       std::cout << b;
-    auto move = agents[static_cast<int>(b.side)]->select_move(b);
+    auto move = agents[static_cast<int>(b.side)]->select_move(b, history);
     if (verbosity >= 2)
       std::cout << "Move " << b.total_moves + 1 << ": " << move << std::endl;
     if (verbosity >= 3)
       std::cout << std::endl;
-    b.make_move(move);
+    b.make_move(move, history);
     ++move_count;
   }
 
@@ -37,8 +40,29 @@ std::pair<chess::Color, int> simulate_game(Agent* white_agent,
 
   if (verbosity >= 1) {
     std::cout << move_count << " moves\n";
+    std::cout << "Result: " << b.game_status() << std::endl;
     std::cout << "Winner: " << static_cast<int>(winner) << std::endl;
   }
 
   return std::make_pair(winner, move_count);
 }
+
+
+std::vector<chess::Board> random_positions(int num_positions, unsigned int seed) {
+  std::mt19937 gen(seed);
+  std::vector<chess::Board> positions;
+  std::unordered_set<uint64_t> hashes;
+  const auto target = static_cast<size_t>(num_positions);
+  while (positions.size() < target) {
+    chess::Board b;
+    chess::History history;
+    while (! b.is_over() && positions.size() < target) {
+      if (hashes.insert(b.hash).second)
+        positions.push_back(b);
+      auto moves = b.generate_legal_moves();
+      std::uniform_int_distribution<size_t> dist(0, moves.size() - 1);
+      b.make_move(moves[dist(gen)], history);
+    }
+  }
+  return positions;
+}
@@ -2,6 +2,7 @@
 #define SIMULATION_H
 
 #include <utility>
+#include <vector>
 
 #include "agent_base.h"
 
@@ -12,5 +13,9 @@ std::pair<chess::Color, int> simulate_game(Agent* black_agent,
                                     int verbosity = 0,
                                     int max_moves = 50000);
 
+/// Distinct positions from random playouts starting at the initial position, for
+/// benchmarking.  The same seed gives the same positions.
+std::vector<chess::Board> random_positions(int num_positions, unsigned int seed);
+
 
 #endif // SIMULATION_H
@@ -6,6 +6,7 @@
 #include <sstream>
 #include <vector>
 #include <algorithm>
+#include <filesystem>
 
 #include "chess/bitboard.h"
 #include "chess/board.h"
@@ -13,7 +14,15 @@
 #include "chess/game_moves.h"
 #include "chess/transform.h"
 #include "utils.h"
+#include "simulation.h"
+#include "trace.h"
+#include "instrument.h"
 #include "zero/encoder.h"
+#include "zero/cached_inference.h"
+#include "zero/cache_trace.h"
+#include "zero/inference_options.h"
+#include "zero/agent_zero.h"
+#include "zero/gumbel.h"
 
 using namespace chess;
 
@@ -320,6 +329,30 @@ TEST_CASE( "Castling", "[movegen]" ) {
   check_move_count(castle_fen, 48);
 }
 
+TEST_CASE( "Legal move count", "[movegen]" ) {
+  // The bulk count must agree with making each move, at every node of a small tree
+  // from positions with pins, checks, en passant, and castling.
+  const std::vector<std::string> fens = {
+    "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+    "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+    "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+    "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+  };
+  std::function<void(const Board&, int)> check_tree = [&](const Board& b, int depth) {
+    const auto legal_moves = b.generate_legal_moves();
+    REQUIRE( b.count_legal_moves() == static_cast<long>(legal_moves.size()) );
+    if (depth == 0)
+      return;
+    for (auto mv : legal_moves) {
+      auto board_copy = b;
+      board_copy.make_move(mv);
+      check_tree(board_copy, depth - 1);
+    }
+  };
+  for (const auto& fen : fens)
+    check_tree(Board(fen), 2);
+}
+
 TEST_CASE( "Benchmark move generation", "[!benchmark][movegen]" ) {
   auto b = Board();
 
@@ -366,6 +399,7 @@ void perft_test_line(const std::string& line, int max_depth) {
   }
 }
 
+
 TEST_CASE( "Perft all", "[.perftsuite]" ) {
   // Largest depth in suite is 6
   const int max_depth = 6;
@@ -383,15 +417,16 @@ TEST_CASE( "Perft all", "[.perftsuite]" ) {
 TEST_CASE( "Debug perft", "[.perftdebug]" ) {
   auto fen = "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1";
   auto b = Board(fen);
+  History history;
   const int depth = 3;
 
   auto move_list = b.generate_all_moves();
   for (auto& mv : move_list.moves) {
-    if (! b.make_move(mv))
+    if (! b.make_move(mv, history))
       continue;
     auto count = b.perft(depth-1);
     std::cout << mv << " " << count << std::endl;
-    b.undo_move();
+    b.undo_move(history);
   }
 }
 
@@ -404,18 +439,137 @@ TEST_CASE( "Game not over at start", "[is_over]" ) {
 
 TEST_CASE( "Draw by repetition", "[is_over]" ) {
   auto b = Board();
+  History history;
 
   for (int i=0; i<2; ++i) {
-    b.make_move(Move(Position::G1, Position::F3));
-    b.make_move(Move(Position::B8, Position::C6));
-    b.make_move(Move(Position::F3, Position::G1));
-    b.make_move(Move(Position::C6, Position::B8));
+    b.make_move(Move(Position::G1, Position::F3), history);
+    b.make_move(Move(Position::B8, Position::C6), history);
+    b.make_move(Move(Position::F3, Position::G1), history);
+    b.make_move(Move(Position::C6, Position::B8), history);
   }
   REQUIRE( b.is_over() );
   REQUIRE( b.winner().value() == Color::both );
 }
 
 
+TEST_CASE( "Game status", "[is_over]" ) {
+  // Fool's mate
+  auto b = Board("rnb1kbnr/pppp1ppp/8/4p3/6Pq/5P2/PPPPP2P/RNBQKBNR w KQkq - 1 3");
+  REQUIRE( b.game_status() == GameStatus::checkmate );
+  REQUIRE( b.winner().value() == Color::black );
+
+  b = Board("7k/5Q2/6K1/8/8/8/8/8 b - - 0 1");
+  REQUIRE( b.game_status() == GameStatus::stalemate );
+  REQUIRE( b.winner().value() == Color::both );
+
+  b = Board("8/8/8/8/8/8/k7/5BK1 w - - 0 1");
+  REQUIRE( b.game_status() == GameStatus::material_draw );
+
+  b = Board("8/8/8/8/8/8/kr6/6K1 w - - 101 80");
+  REQUIRE( b.game_status() == GameStatus::fifty_move_draw );
+
+  // Status is recomputed after a move, and restored when it is undone.
+  b = Board("rnbqkbnr/pppp1ppp/8/4p3/6P1/5P2/PPPPP2P/RNBQKBNR b KQkq - 0 2");
+  History history;
+  REQUIRE( b.game_status() == GameStatus::ongoing );
+  b.make_move(Move(Position::D8, Position::H4), history);
+  REQUIRE( b.game_status() == GameStatus::checkmate );
+  REQUIRE( b.winner().value() == Color::black );
+  b.undo_move(history);
+  REQUIRE( b.game_status() == GameStatus::ongoing );
+  REQUIRE( ! b.winner() );
+
+  // Likewise with copy-make.
+  auto b_copy = b;
+  REQUIRE( b_copy.make_move(Move(Position::D8, Position::H4)) );
+  REQUIRE( b_copy.game_status() == GameStatus::checkmate );
+  REQUIRE( b.game_status() == GameStatus::ongoing );
+}
+
+
+TEST_CASE( "Material signature", "[material]" ) {
+  auto b = Board();
+  REQUIRE( b.material.count(Piece::WP) == 8 );
+  REQUIRE( b.material.count(Piece::BQ) == 1 );
+  REQUIRE( b.material.total() == 32 );
+  REQUIRE( ! b.material.is_insufficient() );
+
+  // Promotion with capture
+  b = Board("1n5k/P7/8/8/8/8/8/K7 w - - 0 1");
+  const auto before = b.material;
+  History history;
+  b.make_move(Move(Position::A7, Position::B8, Piece::BN, Piece::WQ, MoveFlag::none), history);
+  REQUIRE( b.material.count(Piece::WP) == 0 );
+  REQUIRE( b.material.count(Piece::WQ) == 1 );
+  REQUIRE( b.material.count(Piece::BN) == 0 );
+  REQUIRE( b.material.total() == 3 );
+  REQUIRE( b.material == Board("1Q5k/8/8/8/8/8/8/K7 b - - 0 1").material );
+  b.undo_move(history);
+  REQUIRE( b.material == before );
+
+  REQUIRE( Board("8/8/8/8/8/8/k7/6K1 w - - 0 1").material.is_insufficient() );
+  REQUIRE( Board("8/8/8/8/8/8/kn6/5BK1 w - - 0 1").material.is_insufficient() );
+  REQUIRE( ! Board("8/8/8/8/8/8/k7/4NBK1 w - - 0 1").material.is_insufficient() );
+  REQUIRE( ! Board("8/8/8/8/8/8/k7/4NNK1 w - - 0 1").material.is_insufficient() );
+  REQUIRE( ! Board("8/8/8/8/8/8/kp6/6K1 w - - 0 1").material.is_insufficient() );
+}
+
+
+TEST_CASE( "Repetition count", "[is_over]" ) {
+  auto b = Board();
+  History history;
+
+  auto shuffle_knights = [&]() {
+    b.make_move(Move(Position::G1, Position::F3), history);
+    b.make_move(Move(Position::B8, Position::C6), history);
+    b.make_move(Move(Position::F3, Position::G1), history);
+    b.make_move(Move(Position::C6, Position::B8), history);
+  };
+
+  shuffle_knights();
+  REQUIRE( b.repetition_count() == 1 );
+  shuffle_knights();
+  REQUIRE( b.repetition_count() == 2 );
+
+  // Undo restores the previous count.
+  b.undo_move(history);
+  REQUIRE( b.repetition_count() == 1 );
+  b.make_move(Move(Position::C6, Position::B8), history);
+  REQUIRE( b.repetition_count() == 2 );
+
+  // Positions before an irreversible move are not repetitions.
+  b.make_move(Move(Position::E2, Position::E4, Piece::none, Piece::none, MoveFlag::pawnstart), history);
+  b.make_move(Move(Position::E7, Position::E5, Piece::none, Piece::none, MoveFlag::pawnstart), history);
+  shuffle_knights();
+  REQUIRE( b.repetition_count() == 0 );
+  shuffle_knights();
+  REQUIRE( b.repetition_count() == 1 );
+}
+
+
+TEST_CASE( "Copy-make matches make and undo", "[makemove]" ) {
+  const auto fen = "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1";
+  auto b = Board(fen);
+  History history;
+
+  auto move_list = b.generate_all_moves();
+  for (auto& mv : move_list.moves) {
+    auto board_copy = b;
+    auto legal = board_copy.make_move(mv);
+    REQUIRE( b.make_move(mv, history) == legal );
+    if (! legal) {
+      REQUIRE( history.empty() );
+      continue;
+    }
+    REQUIRE( b.hash == board_copy.hash );
+    REQUIRE( history.size() == 1 );
+    b.undo_move(history);
+    REQUIRE( b.hash == Board(fen).hash );
+    REQUIRE( history.empty() );
+  }
+}
+
+
 TEST_CASE( "Test encoder", "[encoder]" ) {
   auto b = Board();
   zero::SimpleEncoder encoder;
@@ -423,5 +577,686 @@ TEST_CASE( "Test encoder", "[encoder]" ) {
   b.make_move(Move(Position::G1, Position::F3));
 
   auto tensor = encoder.encode(b);
-  // std::cout << tensor << std::endl;
+  REQUIRE( tensor.at(Piece::WN, 2, 5) == 1.0 );
+  REQUIRE( tensor.at(Piece::WN, 0, 6) == 0.0 );
+  REQUIRE( tensor.at(Piece::BN, 7, 1) == 1.0 );
+  REQUIRE( tensor.at(14, 0, 0) == 1.0 );
+
+  // The 21 plane encoding leaves the last plane of InputTensor zero.
+  zero::SimpleEncoder encoder_v0(0);
+  REQUIRE( encoder_v0.num_planes() < zero::MAX_INPUT_PLANES );
+  auto tensor_v0 = encoder_v0.encode(b);
+  const auto plane_size = chess::GRID_SIZE * chess::GRID_SIZE;
+  REQUIRE( std::all_of(tensor_v0.data.begin() + encoder_v0.num_planes() * plane_size, tensor_v0.data.end(),
+                       [](float x) { return x == 0.0; }) );
+  REQUIRE( std::equal(tensor_v0.data.begin(), tensor_v0.data.begin() + encoder_v0.num_planes() * plane_size,
+                      tensor.data.begin()) );
+}
+
+
+/// Input planes of SimpleEncoder computed one square at a time from the board, as a
+/// reference for the vectorized plane expansion.
+std::vector<float> reference_planes(const Board& b, int version) {
+  constexpr int plane_size = 64;
+  const bool flip = version >= 2 && b.side == Color::black;
+  std::vector<float> planes((version >= 1 ? 22 : 21) * plane_size, 0.0);
+  auto fill = [&](int plane, float val) {
+    for (Square sq=0; sq<plane_size; ++sq)
+      planes[plane * plane_size + sq] = val;
+  };
+  // Flipping the board for black rotates it by 180 degrees and swaps the colors.
+  auto square = [&](Square sq) { return flip ? 63 - sq : sq; };
+  for (Square sq=0; sq<plane_size; ++sq) {
+    if (! b.pieces[sq].exists())
+      continue;
+    int p = b.pieces[sq].value;
+    if (flip)
+      p = p < 6 ? p + 6 : p - 6;
+    planes[p * plane_size + square(sq)] = 1.0;
+  }
+  fill(12, b.repetition_count() >= 1);
+  fill(13, b.repetition_count() >= 2);
+  fill(14, b.side == Color::black);
+  fill(15, 1.0);
+  const std::array<int, 4> perms = flip
+    ? std::array<int, 4>{castling::BK, castling::BQ, castling::WK, castling::WQ}
+    : std::array<int, 4>{castling::WK, castling::WQ, castling::BK, castling::BQ};
+  for (int i=0; i<4; ++i)
+    fill(16 + i, b.castle_perm[perms[i]]);
+  fill(20, version >= 2 ? static_cast<float>(b.fifty_move) / 100.0 : b.fifty_move);
+  if (version >= 1 && b.en_pas != Position::none)
+    planes[21 * plane_size + square(b.en_pas)] = 1.0;
+  return planes;
+}
+
+
+TEST_CASE( "Batch encoder", "[encoder]" ) {
+  constexpr int plane_size = 64;
+  std::vector<Board> boards = {
+    Board(),
+    Board("rnbqkbnr/ppp1pppp/8/8/3pP3/5N2/PPPP1PPP/RNBQKB1R b KQkq e3 0 3"),
+    Board("r3k2r/8/8/8/8/8/8/R3K2R w Kq - 12 40"),
+  };
+  const auto random_boards = random_positions(200, 1);
+  boards.insert(boards.end(), random_boards.begin(), random_boards.end());
+
+  for (int version : {0, 1, 2}) {
+    zero::SimpleEncoder encoder(version);
+    const int board_size = encoder.num_planes() * plane_size;
+    std::vector<float> batch(boards.size() * board_size, -1.0);
+    encoder.encode_batch(boards, batch.data());
+
+    for (size_t i=0; i<boards.size(); ++i) {
+      const auto planes = reference_planes(boards[i], version);
+      REQUIRE( std::equal(planes.begin(), planes.end(), batch.begin() + i * board_size) );
+      auto tensor = encoder.encode(boards[i]);
+      REQUIRE( std::equal(planes.begin(), planes.end(), tensor.data.begin()) );
+    }
+  }
+
+  // Without orientation, plane p holds the squares of piece p.
+  zero::SimpleEncoder encoder(1);
+  auto b = boards[1];
+  auto tensor = encoder.encode(b);
+  for (Square sq=0; sq<plane_size; ++sq) {
+    for (int p=0; p<chess::NUM_PIECE_TYPES_BOTH; ++p)
+      CHECK( tensor.data[p * plane_size + sq] == (b.pieces[sq].value == p ? 1.0 : 0.0) );
+    CHECK( tensor.data[21 * plane_size + sq] == (sq == Position::E3 ? 1.0 : 0.0) );
+    CHECK( tensor.data[20 * plane_size + sq] == 0.0 );
+    CHECK( tensor.data[14 * plane_size + sq] == 1.0 );
+  }
+
+  // With orientation, black to move sees its own pawns in plane 0, rotated.
+  zero::SimpleEncoder oriented(2);
+  tensor = oriented.encode(b);
+  REQUIRE( tensor.data[0 * plane_size + (63 - Position::A7)] == 1.0 );
+  REQUIRE( tensor.data[0 * plane_size + Position::A7] == 0.0 );
+  REQUIRE( tensor.data[21 * plane_size + (63 - Position::E3)] == 1.0 );
+}
+
+
+TEST_CASE( "Packed encoder", "[encoder]" ) {
+  constexpr int plane_size = 64;
+  std::vector<Board> boards = {
+    Board(),
+    Board("rnbqkbnr/ppp1pppp/8/8/3pP3/5N2/PPPP1PPP/RNBQKB1R b KQkq e3 0 3"),
+    Board("r3k2r/8/8/8/8/8/8/R3K2R b Kq - 12 40"),
+  };
+  // Repeat the starting position once and then twice
+  History history;
+  auto b = Board();
+  for (int i=1; i<=2; ++i) {
+    for (auto mv : {"g1f3", "g8f6", "f3g1", "f6g8"})
+      b.make_move(b.parse_move_string(mv).value(), history);
+    REQUIRE( b.repetition_count() == i );
+    boards.push_back(b);
+  }
+
+  // Expand the packed encoding the same way as nn/packed_input.py.
+  auto unpack = [&](const uint8_t* packed, int version) {
+    const int num_planes = version >= 1 ? 22 : 21;
+    std::vector<float> planes(num_planes * plane_size);
+    auto fill = [&](int plane, float val) {
+      std::fill_n(planes.begin() + plane * plane_size, plane_size, val);
+    };
+    auto expand = [&](int plane, const uint8_t* ranks) {
+      for (Square sq=0; sq<plane_size; ++sq)
+        planes[plane * plane_size + sq] = (ranks[sq / 8] >> (sq % 8)) & 1;
+    };
+    for (int p=0; p<12; ++p)
+      expand(p, packed + 8 * p);
+    const auto* scalars = packed + 8 * 13;
+    fill(12, scalars[0]);
+    fill(13, scalars[1]);
+    fill(14, scalars[2]);
+    fill(15, 1.0);
+    for (int i=0; i<4; ++i)
+      fill(16 + i, scalars[3 + i]);
+    fill(20, version >= 2 ? static_cast<float>(scalars[7]) / 100.0 : scalars[7]);
+    if (version >= 1)
+      expand(21, packed + 8 * 12);
+    return planes;
+  };
+
+  for (int version : {0, 1, 2}) {
+    zero::SimpleEncoder encoder(version);
+    const int packed_size = encoder.packed_size();
+    REQUIRE( packed_size == 112 );
+    std::vector<uint8_t> batch(boards.size() * packed_size);
+    encoder.encode_packed_batch(boards, batch.data());
+
+    for (size_t i=0; i<boards.size(); ++i) {
+      auto tensor = encoder.encode(boards[i]);
+      auto planes = unpack(batch.data() + i * packed_size, version);
+      REQUIRE( std::equal(planes.begin(), planes.end(), tensor.data.begin()) );
+    }
+  }
+}
+
+
+TEST_CASE( "Legal move softmax", "[encoder]" ) {
+  zero::PolicyTensor policy;
+  policy.at(0, 1, 2) = 1.0;
+  policy.at(10, 0, 0) = 3.0;
+  policy.at(72, 7, 7) = -2.0;
+  const std::vector<int64_t> indices = {
+    zero::PolicyTensor::index(0, 1, 2),
+    zero::PolicyTensor::index(10, 0, 0),
+    zero::PolicyTensor::index(72, 7, 7),
+  };
+
+  for (float temperature : {1.0f, 2.0f}) {
+    std::vector<float> priors;
+    zero::legal_move_softmax(policy, indices, temperature, priors);
+    REQUIRE( priors.size() == 3 );
+    CHECK( std::abs(priors[0] + priors[1] + priors[2] - 1.0) < 1e-6 );
+    CHECK( std::abs(priors[1] / priors[0] - std::exp(2.0 / temperature)) < 1e-4 );
+    CHECK( std::abs(priors[0] / priors[2] - std::exp(3.0 / temperature)) < 1e-3 );
+  }
+}
+
+
+TEST_CASE( "Inference options file", "[inference]" ) {
+  zero::InferenceOptions options;
+  options.set("provider", "xnnpack");
+  options.set("optimization", "extended");
+  options.set("intra_threads", "4");
+  options.set("parallel", "true");
+
+  const auto path = std::filesystem::temp_directory_path() / "dlchess_inference_options_test";
+  options.save(path.string());
+  REQUIRE( zero::InferenceOptions::load(path.string()) == options );
+  std::filesystem::remove(path);
+
+  REQUIRE_THROWS_AS( options.set("provider", "cuda"), std::invalid_argument );
+  REQUIRE_THROWS_AS( options.set("intra_threads", "-1"), std::invalid_argument );
+  REQUIRE_THROWS_AS( options.set("threads", "1"), std::invalid_argument );
+  REQUIRE( options.provider == "xnnpack" );
+}
+
+
+#if defined(DLCHESS_TEST_NETWORK) && defined(DLCHESS_TEST_LEGAL_MOVE_NETWORK)
+TEST_CASE( "Network signatures give the same priors", "[inference]" ) {
+  auto encoder = std::make_shared<zero::SimpleEncoder>(2);
+  const float temperature = 1.359f;
+  zero::CachedInferenceModel full(std::make_shared<zero::InferenceModel>(DLCHESS_TEST_NETWORK),
+                                  encoder, 100, temperature, true);
+  zero::CachedInferenceModel legal(std::make_shared<zero::InferenceModel>(DLCHESS_TEST_LEGAL_MOVE_NETWORK),
+                                   encoder, 100, temperature, true);
+
+  for (const auto* fen : {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+                          "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+                          "n1n5/PPPk4/8/8/8/8/4Kppp/5N1N b - - 0 1"}) {
+    const Board b(fen);
+    bool cache_hit;
+    const auto& full_output = full(b, cache_hit);
+    const auto& legal_output = legal(b, cache_hit);
+    CHECK( std::abs(full_output.value - legal_output.value) < 1e-5 );
+    REQUIRE( full_output.move_priors.size() == legal_output.move_priors.size() );
+    for (const auto& [mv, prior] : full_output.move_priors)
+      CHECK( std::abs(prior - legal_output.move_priors.at(mv)) < 1e-5 );
+  }
+
+  // A finished game is not evaluated, so its value is the result.
+  const Board mated("rnb1kbnr/pppp1ppp/8/4p3/6Pq/5P2/PPPPP2P/RNBQKBNR w KQkq - 1 3");
+  bool cache_hit;
+  const auto& output = legal(mated, cache_hit);
+  CHECK( output.move_priors.empty() );
+  CHECK( output.value == -1.0f );
+}
+#endif
+
+
+TEST_CASE( "Network cache eviction", "[cache]" ) {
+  zero::clock_map<int> cache(2);
+  cache.insert(1, 10);
+  cache.insert(2, 20);
+  REQUIRE( *cache.find(1) == 10 );
+
+  // Both entries are from the current search, so the hit gives 1 a second chance.
+  cache.insert(3, 30);
+  REQUIRE( cache.find(2) == nullptr );
+  REQUIRE( cache.find(1) != nullptr );
+
+  // In a new search, the entry used in it survives over the unused one.
+  cache.new_generation();
+  REQUIRE( cache.find(3) != nullptr );
+  cache.insert(4, 40);
+  REQUIRE( cache.find(1) == nullptr );
+  REQUIRE( *cache.find(3) == 30 );
+  REQUIRE( *cache.find(4) == 40 );
+
+  const auto stats = cache.stats();
+  REQUIRE( stats.hits == 5 );
+  REQUIRE( stats.misses == 2 );
+  REQUIRE( stats.evictions == 2 );
+  REQUIRE( stats.size == 2 );
+  REQUIRE( stats.capacity == 2 );
+
+  cache.clear();
+  REQUIRE( cache.size() == 0 );
+  REQUIRE( cache.find(3) == nullptr );
+}
+
+
+TEST_CASE( "Cache trace and policies", "[cache]" ) {
+  const auto marker = zero::CacheTraceWriter::SEARCH_MARKER;
+  const auto path = std::filesystem::temp_directory_path() / "dlchess_cache_trace_test";
+  {
+    zero::CacheTraceWriter writer(path.string());
+    for (uint64_t key : {1, 2, 1, 3, 1})
+      writer.lookup(key);
+    writer.new_search();
+    writer.lookup(marker);
+  }
+  const auto trace = zero::read_cache_trace(path.string());
+  std::filesystem::remove(path);
+  REQUIRE( trace == std::vector<uint64_t>{1, 2, 1, 3, 1, marker, 1} );
+
+  auto hits = [](const std::string& name, const std::vector<uint64_t>& keys, size_t capacity = 2) {
+    auto policy = zero::cache_sim::make_policy(name, capacity);
+    return zero::cache_sim::simulate(keys, *policy).hits;
+  };
+  // FIFO evicts 1 for 3 although it was used again, the others evict 2.
+  const std::vector<uint64_t> keys = {1, 2, 1, 3, 1};
+  REQUIRE( hits("fifo", keys) == 1 );
+  REQUIRE( hits("lru", keys) == 2 );
+  REQUIRE( hits("clock", keys) == 2 );
+  REQUIRE( hits("generation", keys) == 2 );
+  // In a new search, 1 is no longer protected.
+  REQUIRE( hits("generation", {1, 2, 1, marker, 3, 1}) == 1 );
+  // A key that comes back after leaving the FIFO of new keys survives a scan in 2Q.
+  const std::vector<uint64_t> scan = {1, 2, 3, 4, 5, 1, 6, 7, 8, 9, 1};
+  REQUIRE( hits("2q", scan, 4) == 1 );
+  REQUIRE( hits("fifo", scan, 4) == 0 );
+
+  REQUIRE_THROWS_AS( zero::cache_sim::make_policy("random", 2), std::invalid_argument );
+  REQUIRE_THROWS_AS( zero::cache_sim::make_policy("lru", 0), std::invalid_argument );
+}
+
+
+TEST_CASE( "Tree memory accounting", "[search]" ) {
+  const Board b;
+  zero::priors_type priors;
+  for (auto mv : b.generate_legal_moves())
+    priors.emplace(mv, 0.05f);
+  auto root = std::make_shared<zero::ZeroNode>(b, 0.0, priors, std::weak_ptr<zero::ZeroNode>(), std::nullopt);
+  const auto root_bytes = root->bytes();
+  REQUIRE( root_bytes > sizeof(zero::ZeroNode) + priors.size() * sizeof(zero::Branch) );
+
+  const auto mv = priors.begin()->first;
+  auto child_board = b;
+  child_board.make_move(mv);
+  auto child = std::make_shared<zero::ZeroNode>(child_board, 0.0, priors, root, mv);
+  root->add_child(mv, child);
+  REQUIRE( root->bytes() > root_bytes );
+
+  REQUIRE( zero::parse_tree_memory_action("stop") == zero::TreeMemoryAction::stop );
+  REQUIRE( zero::parse_tree_memory_action("prune") == zero::TreeMemoryAction::prune );
+  REQUIRE_THROWS_AS( zero::parse_tree_memory_action("grow"), std::invalid_argument );
+}
+
+
+TEST_CASE( "Smart pruning", "[search]" ) {
+  const Board b;
+  auto encoder = std::make_shared<zero::SimpleEncoder>(2);
+  zero::ZeroAgent agent(nullptr, encoder);
+  agent.info.num_rounds = 100;
+  agent.info.num_randomized_moves = 0;
+
+  const auto moves = b.generate_legal_moves();
+  zero::priors_type priors;
+  for (auto mv : moves)
+    priors.emplace(mv, 0.05f);
+  auto root = std::make_shared<zero::ZeroNode>(b, 0.0, priors, std::weak_ptr<zero::ZeroNode>(), std::nullopt);
+  for (int i=0; i<40; ++i)
+    root->record_visit(moves[0], 0.1f);
+  for (int i=0; i<10; ++i)
+    root->record_visit(moves[1], 0.0f);
+
+  // Lead of 30 with 50 playouts left
+  agent.info.smart_pruning_factor = 0.0;
+  REQUIRE_FALSE( agent.best_move_decided(*root, 50) );
+  agent.info.smart_pruning_factor = 1.0;
+  REQUIRE_FALSE( agent.best_move_decided(*root, 50) );
+  agent.info.smart_pruning_factor = 2.0;
+  REQUIRE( agent.best_move_decided(*root, 50) );
+
+  // Lead of 30 with 20 playouts left
+  agent.info.smart_pruning_factor = 1.0;
+  REQUIRE( agent.best_move_decided(*root, 80) );
+
+  // Not while moves are selected in proportion to visits
+  agent.info.num_randomized_moves = 10;
+  REQUIRE_FALSE( agent.best_move_decided(*root, 80) );
+}
+
+
+TEST_CASE( "Single legal move", "[search]" ) {
+  // The king must take the queen.  The agent has no network, so this fails if the
+  // position is evaluated.
+  const Board b("7k/8/8/8/8/8/6q1/7K w - - 0 1");
+  REQUIRE( b.generate_legal_moves().size() == 1 );
+  auto encoder = std::make_shared<zero::SimpleEncoder>(2);
+  zero::ZeroAgent agent(nullptr, encoder);
+  agent.info.num_rounds = 100;
+  REQUIRE( agent.select_move(b, History()) == Move(Position::H1, Position::G2) );
+  REQUIRE( agent.last_search_stats().rounds == 0 );
+  REQUIRE( agent.last_search_stats().stopped_early );
+}
+
+
+TEST_CASE( "Proven results", "[search]" ) {
+  auto make_root = [](const Board& board) {
+    zero::priors_type priors;
+    for (auto mv : board.generate_legal_moves())
+      priors.emplace(mv, 0.05f);
+    return std::make_shared<zero::ZeroNode>(board, 0.0, priors, std::weak_ptr<zero::ZeroNode>(), std::nullopt);
+  };
+  auto expand = [](const std::shared_ptr<zero::ZeroNode>& node, Move mv) {
+    auto board = node->game_board;
+    board.make_move(mv);
+    zero::priors_type priors;
+    for (auto child_move : board.generate_legal_moves())
+      priors.emplace(child_move, 0.05f);
+    auto child = std::make_shared<zero::ZeroNode>(board, 0.0, priors, node, mv);
+    node->add_child(mv, child);
+    zero::backup(node, mv, -child->value);
+    return child;
+  };
+
+  // Mate in one
+  Board b("6k1/5ppp/8/8/8/8/8/R5K1 w - - 0 1");
+  auto root = make_root(b);
+  const auto quiet = b.parse_move_string("g1f1").value();
+  const auto mate = b.parse_move_string("a1a8").value();
+  expand(root, quiet);
+  REQUIRE( root->proven == zero::Proven::unknown );
+  auto child = expand(root, mate);
+  REQUIRE( child->terminal );
+  REQUIRE( child->proven == zero::Proven::loss );
+  REQUIRE( root->proven == zero::Proven::win );
+  REQUIRE( root->proven_plies == 1 );
+  REQUIRE( root->branches.at(mate).expected_value(0.0) == 1.0f );
+  REQUIRE( root->get_best_move() == mate );
+  // A visit to the proven child backs up its exact value.
+  zero::backup(child, std::nullopt, zero::proven_value(child->proven));
+  REQUIRE( root->branches.at(mate).visit_count == 2 );
+
+  // A node is a draw once all its moves are proven and one draws, else a loss.
+  auto node = make_root(Board());
+  auto loss = std::make_shared<zero::ZeroNode>(*child);
+  loss->proven = zero::Proven::win;
+  loss->proven_plies = 4;
+  auto draw = std::make_shared<zero::ZeroNode>(*child);
+  draw->proven = zero::Proven::draw;
+  auto it = node->branches.begin();
+  for (; std::next(it) != node->branches.end(); ++it)
+    REQUIRE_FALSE( node->update_proof(it->first, *loss) );
+  REQUIRE( node->update_proof(it->first, *draw) );
+  REQUIRE( node->proven == zero::Proven::draw );
+  // The plies of the losing moves don't count for the draw.
+  REQUIRE( node->proven_plies == draw->proven_plies + 1 );
+  REQUIRE( node->get_best_move() == it->first );
+
+  auto lost = make_root(Board());
+  for (const auto& [mv, branch] : node->branches)
+    lost->update_proof(mv, *loss);
+  REQUIRE( lost->proven == zero::Proven::loss );
+  REQUIRE( lost->proven_plies == 5 );
+
+  // Without the underpromotions, losing every move searched doesn't prove a loss.
+  const Board promotion("8/P7/8/8/8/8/8/k1K5 w - - 0 1");
+  zero::priors_type priors;
+  for (auto mv : promotion.generate_legal_moves()) {
+    if (! mv.is_underpromotion())
+      priors.emplace(mv, 0.05f);
+  }
+  auto partial = std::make_shared<zero::ZeroNode>(promotion, 0.0, priors, std::weak_ptr<zero::ZeroNode>(), std::nullopt);
+  REQUIRE_FALSE( partial->all_moves );
+  for (const auto& [mv, branch] : priors)
+    REQUIRE_FALSE( partial->update_proof(mv, *loss) );
+  REQUIRE( partial->proven == zero::Proven::unknown );
+  auto complete = make_root(promotion);
+  REQUIRE( complete->all_moves );
+  for (const auto& [mv, branch] : complete->branches)
+    complete->update_proof(mv, *loss);
+  REQUIRE( complete->proven == zero::Proven::loss );
+
+  // The most visited move is proven to lose after its visits.
+  auto searched = make_root(Board());
+  const auto moves = searched->game_board.generate_legal_moves();
+  for (int i=0; i<40; ++i)
+    searched->record_visit(moves[0], 0.1f);
+  for (int i=0; i<10; ++i)
+    searched->record_visit(moves[1], 0.0f);
+  zero::ZeroAgent agent(nullptr, std::make_shared<zero::SimpleEncoder>(2));
+  agent.info.num_rounds = 100;
+  agent.info.num_randomized_moves = 0;
+  agent.info.smart_pruning_factor = 1.0;
+  REQUIRE( searched->get_best_move() == moves[0] );
+  REQUIRE( agent.best_move_decided(*searched, 80) );
+  REQUIRE_FALSE( searched->update_proof(moves[0], *loss) );
+  REQUIRE( searched->get_best_move() == moves[1] );
+  REQUIRE_FALSE( agent.best_move_decided(*searched, 80) );
+  // A winning move is played at once.
+  REQUIRE( searched->update_proof(moves[2], *child) );
+  REQUIRE( searched->get_best_move() == moves[2] );
+}
+
+
+TEST_CASE( "Gumbel root search", "[search]" ) {
+  // Four moves visited twice each, then the best two visited four more times each
+  REQUIRE( zero::GumbelRoot::considered_visits(4, 16) ==
+           std::vector<int>({0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5}) );
+  REQUIRE( zero::GumbelRoot::considered_visits(1, 3) == std::vector<int>({0, 1, 2}) );
+
+  const Board b;
+  const auto moves = b.generate_legal_moves();
+  zero::priors_type priors;
+  for (size_t i=0; i<moves.size(); ++i)
+    priors.emplace(moves[i], i == 0 ? 0.43f : 0.03f);
+  auto root = std::make_shared<zero::ZeroNode>(b, 0.0, priors, std::weak_ptr<zero::ZeroNode>(), std::nullopt);
+
+  // Without noise the first playouts go to the moves with the highest priors.
+  const zero::GumbelRoot gumbel(*root, 16, 4, 50.0, 0.1, false);
+  REQUIRE( gumbel.select(*root, 0) == moves[0] );
+  root->record_visit(moves[0], -0.5f);
+  const auto second = gumbel.select(*root, 1);
+  REQUIRE( second != moves[0] );
+  root->record_visit(second, 0.5f);
+
+  // The improved policy moves probability to the move that did better than expected.
+  float sum = 0.0;
+  float first_policy = 0.0;
+  float second_policy = 0.0;
+  for (const auto& [mv, p] : gumbel.improved_policy(*root)) {
+    sum += p;
+    if (mv == moves[0])
+      first_policy = p;
+    else if (mv == second)
+      second_policy = p;
+  }
+  REQUIRE( std::abs(sum - 1.0f) < 1e-5f );
+  REQUIRE( first_policy < 0.43f );
+  REQUIRE( second_policy > 0.03f );
+}
+
+
+TEST_CASE( "Tree teardown", "[search]" ) {
+  const Board b;
+  zero::priors_type priors;
+  const auto mv = b.generate_legal_moves().front();
+  priors.emplace(mv, 1.0f);
+
+  // A line deep enough to overflow the stack if nodes were destroyed recursively.
+  auto root = std::make_shared<zero::ZeroNode>(b, 0.0, priors, std::weak_ptr<zero::ZeroNode>(), std::nullopt);
+  auto node = root;
+  for (int i=0; i<200000; ++i) {
+    auto child = std::make_shared<zero::ZeroNode>(b, 0.0, priors, node, mv);
+    node->add_child(mv, child);
+    node = child;
+  }
+  const std::weak_ptr<zero::ZeroNode> leaf = node;
+  node.reset();
+
+  zero::TreeReclaimer reclaimer;
+  const std::weak_ptr<zero::ZeroNode> weak_root = root;
+  reclaimer.release(std::move(root));
+  reclaimer.wait();
+  REQUIRE( weak_root.expired() );
+  REQUIRE( leaf.expired() );
+}
+
+
+TEST_CASE( "Benchmark search phases", "[!benchmark][search]" ) {
+  auto b = Board("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+  const auto moves = b.generate_legal_moves();
+  auto encoder = std::make_shared<zero::SimpleEncoder>(2);
+
+  BENCHMARK("generate_legal_moves") {
+    return b.generate_legal_moves();
+  };
+
+  History history;
+  BENCHMARK("make/undo") {
+    b.make_move(moves.front(), history);
+    b.undo_move(history);
+    return b.hash;
+  };
+
+  BENCHMARK("encode") {
+    return encoder->encode(b);
+  };
+
+  BENCHMARK("decode_legal_moves") {
+    return encoder->decode_legal_moves(b);
+  };
+
+  // Uniform priors, for building search nodes without a network
+  auto uniform_priors = [](const Board& board) {
+    zero::priors_type priors;
+    const auto legal_moves = board.generate_legal_moves();
+    for (auto mv : legal_moves)
+      priors.emplace(mv, 1.0f / static_cast<float>(legal_moves.size()));
+    return priors;
+  };
+
+  // Same key computation and lookup as CachedInferenceModel, on a full cache
+  zero::clock_map<zero::NetworkOutput> cache(1000);
+  for (uint64_t key=0; key<1000; ++key)
+    cache.insert(utils::Hash(key), zero::NetworkOutput(uniform_priors(b), 0.0));
+  BENCHMARK("cache probe") {
+    auto hash = utils::HashCat(b.hash, b.repetition_count());
+    hash = utils::HashCat(hash, b.fifty_move);
+    return cache.find(hash) != nullptr;
+  };
+
+  zero::ZeroAgent agent(nullptr, encoder);
+  auto root = std::make_shared<zero::ZeroNode>(b, 0.0, uniform_priors(b), std::weak_ptr<zero::ZeroNode>(), std::nullopt);
+  for (size_t i=0; i<moves.size(); i+=3)
+    root->record_visit(moves[i], 0.1f * static_cast<float>(i % 7) - 0.3f);
+  BENCHMARK("select_branch") {
+    return agent.select_branch(*root);
+  };
+
+  // Backup along a line of 8 nodes
+  auto leaf = root;
+  auto line_board = b;
+  for (int depth=0; depth<8; ++depth) {
+    auto mv = line_board.generate_legal_moves().front();
+    line_board.make_move(mv);
+    auto child = std::make_shared<zero::ZeroNode>(line_board, 0.0, uniform_priors(line_board), leaf, mv);
+    leaf->add_child(mv, child);
+    leaf = child;
+  }
+  const auto leaf_move = leaf->branches.begin()->first;
+  BENCHMARK("backup") {
+    zero::backup(leaf, leaf_move, 0.5);
+  };
+}
+
+
+TEST_CASE( "Mapped file", "[utils]" ) {
+  const auto path = std::filesystem::temp_directory_path() / "dlchess_mapped_file_test";
+  const std::string contents = "in state\nout policy\nout value\n";
+  std::ofstream(path) << contents;
+
+  {
+    const utils::MappedFile file(path.string());
+    REQUIRE( file.size() == contents.size() );
+    REQUIRE( std::string(static_cast<const char*>(file.data()), file.size()) == contents );
+  }
+  std::filesystem::remove(path);
+
+  REQUIRE_THROWS( utils::MappedFile(path.string()) );
+}
+
+
+TEST_CASE( "Trace ring buffer", "[trace]" ) {
+  trace::RingBuffer buffer(4, 0);
+  REQUIRE( buffer.events().empty() );
+  for (uint64_t i=0; i<6; ++i)
+    buffer.push({"scope", i, i % 2 ? 'E' : 'B'});
+
+  // The oldest two events are overwritten.
+  const auto events = buffer.events();
+  REQUIRE( events.size() == 4 );
+  for (uint64_t i=0; i<4; ++i)
+    CHECK( events[i].timestamp_ns == i + 2 );
+}
+
+
+// Paths that should not allocate.  The counts are only checked in builds with
+// -DALLOC_HOOKS=ON.
+TEST_CASE( "Allocation-free paths", "[instrument]" ) {
+  auto check_allocations = [](uint64_t allocations, uint64_t expected) {
+    if (instrument::ALLOC_ENABLED)
+      REQUIRE( allocations == expected );
+  };
+
+  {
+    const instrument::AllocationCounter counter;
+    auto p = std::make_unique<int>(1);
+    check_allocations(counter.allocations(), 1);
+  }
+
+  auto b = Board("r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1");
+  const auto moves = b.generate_legal_moves();
+  zero::priors_type priors;
+  for (auto mv : moves)
+    priors.emplace(mv, 1.0f / static_cast<float>(moves.size()));
+
+  History history;
+  b.make_move(moves.front(), history);
+  b.undo_move(history);
+  {
+    const instrument::AllocationCounter counter;
+    b.make_move(moves.front(), history);
+    b.undo_move(history);
+    check_allocations(counter.allocations(), 0);
+  }
+
+  auto encoder = std::make_shared<zero::SimpleEncoder>(2);
+  zero::ZeroAgent agent(nullptr, encoder);
+  auto root = std::make_shared<zero::ZeroNode>(b, 0.0, priors, std::weak_ptr<zero::ZeroNode>(), std::nullopt);
+  auto child_board = b;
+  child_board.make_move(moves.front());
+  auto child = std::make_shared<zero::ZeroNode>(child_board, 0.0, priors, root, moves.front());
+  root->add_child(moves.front(), child);
+  {
+    const instrument::AllocationCounter counter;
+    agent.select_branch(*root);
+    zero::backup(child, child->branches.begin()->first, 0.5);
+    check_allocations(counter.allocations(), 0);
+  }
+
+  zero::PolicyTensor policy;
+  const std::vector<int64_t> indices = {1, 100, 1000};
+  std::vector<float> softmax_priors(indices.size());
+  {
+    const instrument::AllocationCounter counter;
+    zero::legal_move_softmax(policy, indices, 1.0, softmax_priors);
+    check_allocations(counter.allocations(), 0);
+  }
 }
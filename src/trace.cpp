@@ -0,0 +1,85 @@
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <stdexcept>
+
+#include "trace.h"
+
+
+namespace {
+
+  std::mutex registry_mutex;
+  std::vector<std::unique_ptr<trace::RingBuffer>> registry;
+  size_t buffer_capacity = 0;
+
+};
+
+namespace trace {
+
+  std::vector<Event> RingBuffer::events() const {
+    const auto head = head_.load(std::memory_order_acquire);
+    const auto size = std::min<uint64_t>(head, slots_.size());
+    std::vector<Event> result;
+    result.reserve(size);
+    for (auto i = head - size; i < head; ++i) {
+      const auto& slot = slots_[i % slots_.size()];
+      result.push_back({slot.name.load(std::memory_order_relaxed),
+                        slot.timestamp_ns.load(std::memory_order_relaxed),
+                        slot.type.load(std::memory_order_relaxed)});
+    }
+    return result;
+  }
+
+  namespace detail {
+
+    RingBuffer* register_thread() {
+      const std::lock_guard<std::mutex> lock(registry_mutex);
+      registry.push_back(std::make_unique<RingBuffer>(buffer_capacity, static_cast<int>(registry.size())));
+      thread_buffer = registry.back().get();
+      return thread_buffer;
+    }
+
+  };
+
+  void start(size_t capacity_per_thread) {
+    if constexpr (! COMPILED)
+      return;
+    {
+      const std::lock_guard<std::mutex> lock(registry_mutex);
+      buffer_capacity = capacity_per_thread;
+    }
+    detail::start_time = std::chrono::steady_clock::now();
+    detail::enabled.store(true, std::memory_order_relaxed);
+  }
+
+  void write_json(const std::string& path) {
+    detail::enabled.store(false, std::memory_order_relaxed);
+
+    std::ofstream fout(path, std::ios::out);
+    if (! fout)
+      throw std::runtime_error("unable to open file: " + path);
+
+    fout << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+    fout << std::fixed << std::setprecision(3);
+    bool first = true;
+    const std::lock_guard<std::mutex> lock(registry_mutex);
+    for (const auto& buffer : registry) {
+      // If the buffer wrapped, the oldest events may be ends without a begin.
+      int depth = 0;
+      for (const auto& event : buffer->events()) {
+        if (event.type == 'E' && depth == 0)
+          continue;
+        depth += event.type == 'B' ? 1 : -1;
+        fout << (first ? "\n" : ",\n");
+        first = false;
+        // Timestamps are in microseconds.
+        fout << "{\"name\": \"" << event.name << "\", \"ph\": \"" << event.type
+             << "\", \"ts\": " << static_cast<double>(event.timestamp_ns) / 1000.0
+             << ", \"pid\": 1, \"tid\": " << buffer->thread_id() << "}";
+      }
+    }
+    fout << "\n]}\n";
+  }
+
+};
@@ -0,0 +1,135 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/// Timeline tracing in the Chrome trace-event format, for chrome://tracing or Perfetto.
+///
+/// Scopes record begin and end events into a ring buffer owned by the recording
+/// thread, so recording takes no locks.  When a buffer is full, the oldest events are
+/// overwritten.  Tracing is compiled in with the TRACE CMake option, and then enabled
+/// at run time with start().  Otherwise COMPILED is false and scopes compile to
+/// nothing.
+namespace trace {
+
+#ifdef DLCHESS_TRACE
+  inline constexpr bool COMPILED = true;
+#else
+  inline constexpr bool COMPILED = false;
+#endif
+
+  struct Event {
+    /// Static string, e.g. a literal
+    const char* name;
+    uint64_t timestamp_ns;
+    /// 'B' for begin or 'E' for end
+    char type;
+  };
+
+  /// Single-writer ring buffer of the events of one thread.
+  ///
+  /// The fields of each slot are relaxed atomics, which compile to plain moves, so the
+  /// buffer can be read while its thread is still recording.  A slot that is
+  /// overwritten during the read may then give a mixed event, so the events are only
+  /// exact once the writing thread has stopped recording.
+  class RingBuffer {
+  public:
+    RingBuffer(size_t capacity, int thread_id) : slots_(capacity), thread_id_(thread_id) {}
+
+    void push(const Event& event) {
+      const auto head = head_.load(std::memory_order_relaxed);
+      auto& slot = slots_[head % slots_.size()];
+      slot.name.store(event.name, std::memory_order_relaxed);
+      slot.timestamp_ns.store(event.timestamp_ns, std::memory_order_relaxed);
+      slot.type.store(event.type, std::memory_order_relaxed);
+      head_.store(head + 1, std::memory_order_release);
+    }
+
+    /// Events in the order they were recorded, oldest first.
+    std::vector<Event> events() const;
+
+    int thread_id() const { return thread_id_; }
+
+  private:
+    struct Slot {
+      std::atomic<const char*> name {nullptr};
+      std::atomic<uint64_t> timestamp_ns {0};
+      std::atomic<char> type {0};
+    };
+
+    std::vector<Slot> slots_;
+    std::atomic<uint64_t> head_ {0};
+    int thread_id_;
+  };
+
+  namespace detail {
+    inline std::atomic<bool> enabled {false};
+    inline std::chrono::steady_clock::time_point start_time;
+    inline thread_local RingBuffer* thread_buffer = nullptr;
+
+    /// Create and register the buffer of the calling thread.
+    RingBuffer* register_thread();
+
+    inline void record(const char* name, char type) {
+      auto* buffer = thread_buffer ? thread_buffer : register_thread();
+      const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start_time).count();
+      buffer->push({name, static_cast<uint64_t>(ns), type});
+    }
+  };
+
+  /// Start recording, with room for the given number of events per thread.
+  void start(size_t capacity_per_thread = size_t{1} << 20);
+
+  /// Stop recording and write the events of all threads as trace-event JSON.  Threads
+  /// that may still be recording, such as the TreeReclaimer of an agent, should be idle
+  /// first, or their last events may be incomplete.
+  void write_json(const std::string& path);
+
+  inline bool enabled() {
+    if constexpr (COMPILED)
+      return detail::enabled.load(std::memory_order_relaxed);
+    return false;
+  }
+
+  /// Records a begin event on construction and an end event on destruction.
+  class Scope {
+  public:
+    explicit Scope(const char* name) {
+      if constexpr (COMPILED) {
+        if (enabled()) {
+          name_ = name;
+          detail::record(name_, 'B');
+        }
+      }
+    }
+
+    ~Scope() {
+      end();
+    }
+
+    /// End the scope early.
+    void end() {
+      if constexpr (COMPILED) {
+        if (name_) {
+          detail::record(name_, 'E');
+          name_ = nullptr;
+        }
+      }
+    }
+
+    Scope(const Scope&) = delete;
+    Scope& operator=(const Scope&) = delete;
+
+  private:
+    const char* name_ = nullptr;
+  };
+
+};
+
+#endif // TRACE_H_
@@ -1,4 +1,11 @@
 #include <iomanip>
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "utils.h"
 
@@ -29,4 +36,34 @@ namespace utils {
     return ss.str();
   }
 
+  double peak_rss_mb() {
+    struct rusage usage {};
+    getrusage(RUSAGE_SELF, &usage);
+    // Linux reports kilobytes
+    return static_cast<double>(usage.ru_maxrss) / 1024.0;
+  }
+
+  MappedFile::MappedFile(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::runtime_error("unable to open file: " + path);
+
+    struct stat st {};
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      close(fd);
+      throw std::runtime_error("unable to read file: " + path);
+    }
+    size_ = st.st_size;
+
+    data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping stays valid after the descriptor is closed.
+    close(fd);
+    if (data_ == MAP_FAILED)
+      throw std::runtime_error("unable to map file: " + path);
+  }
+
+  MappedFile::~MappedFile() {
+    munmap(data_, size_);
+  }
+
 };
@@ -40,6 +40,26 @@ namespace utils {
 
   std::string format_seconds(double);
 
+  /// Peak resident set size of this process, in MB.
+  double peak_rss_mb();
+
+  /// Read-only memory mapping of a file.  Pages are shared with other processes that
+  /// map the same file.
+  class MappedFile {
+  public:
+    MappedFile(const std::string& path);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const void* data() const { return data_; }
+    size_t size() const { return size_; }
+
+  private:
+    void* data_;
+    size_t size_;
+  };
+
   template <typename T>
   class SyncQueue {
   public:
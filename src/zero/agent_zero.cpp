@@ -1,9 +1,13 @@
 #include <algorithm>
 #include <cmath>
+#include <utility>
 
 #include "agent_zero.h"
+#include "gumbel.h"
 #include "../myrand.h"
 #include "../utils.h"
+#include "../instrument.h"
+#include "../trace.h"
 
 
 using chess::Move;
@@ -26,6 +30,7 @@ namespace zero {
                                    std::optional<int> time_left_ms,
                                    std::optional<int> inc_ms,
                                    const chess::Board& b) {
+    const auto saved_ms = std::exchange(saved_time_ms, 0.0f);
     if (!time_manager)
       return;
 
@@ -35,6 +40,8 @@ namespace zero {
       duration_ms = static_cast<float>(move_time_ms.value());
     else if (time_left_ms) {
       duration_ms = time_manager->budget_ms(*time_left_ms, inc_ms, b);
+      // Spend the time saved by the last search, up to doubling the budget.
+      duration_ms += std::clamp(saved_ms, 0.0f, duration_ms);
     }
     else {
       // Don't have any time settings, so just make sure the time limit is not set
@@ -72,16 +79,73 @@ namespace zero {
 
 
 
+  TreeMemoryAction parse_tree_memory_action(const std::string& name) {
+    if (name == "stop")
+      return TreeMemoryAction::stop;
+    if (name == "prune")
+      return TreeMemoryAction::prune;
+    throw std::invalid_argument("unknown tree memory action: " + name);
+  }
+
   float value_to_centipawns(float value) {
     return 111.714640912 * std::tan(1.5620688421 * value);
   }
 
+  namespace {
+
+    /// KL divergence of the later visit distribution from the earlier one, over the
+    /// same moves.  Visits only grow, so every move visited earlier is visited later.
+    double visit_kl_divergence(const std::vector<int>& earlier, const std::vector<int>& later) {
+      double earlier_total = 0.0;
+      double later_total = 0.0;
+      for (size_t i=0; i<earlier.size(); ++i) {
+        earlier_total += earlier[i];
+        later_total += later[i];
+      }
+      double divergence = 0.0;
+      for (size_t i=0; i<earlier.size(); ++i) {
+        if (earlier[i] == 0)
+          continue;
+        const auto p = earlier[i] / earlier_total;
+        divergence += p * std::log(p * later_total / later[i]);
+      }
+      return divergence;
+    }
+
+    std::vector<int> root_visits(const ZeroNode& root) {
+      std::vector<int> visits;
+      visits.reserve(root.branches.size());
+      for (const auto& [move, branch] : root.branches)
+        visits.push_back(branch.visit_count);
+      return visits;
+    }
+
+    /// Playouts before the playout rate is trusted to estimate the playouts left.
+    constexpr int SMART_PRUNING_MIN_ROUNDS = 100;
+
+    /// Heap memory of a malloc of the given size: glibc adds an 8 byte header and
+    /// rounds up to a multiple of 16, with a minimum of 32.
+    size_t allocation_bytes(size_t size) {
+      return std::max<size_t>(32, (size + 8 + 15) / 16 * 16);
+    }
+
+    /// Heap memory of an unordered_map in libstdc++: the bucket array, unless there is
+    /// a single bucket which is stored inline, and a node per element with the next
+    /// pointer, the value and the cached hash.
+    template <class Map>
+    size_t map_bytes(const Map& map) {
+      const auto buckets = map.bucket_count() > 1 ? allocation_bytes(map.bucket_count() * sizeof(void*)) : 0;
+      return buckets + map.size() * allocation_bytes(sizeof(void*) + sizeof(typename Map::value_type) + sizeof(size_t));
+    }
+
+  };
+
   ZeroNode::ZeroNode(const chess::Board& game_board, float value,
                      const std::unordered_map<Move, float, MoveHash>& priors,
                      std::weak_ptr<ZeroNode> parent,
                      std::optional<Move> last_move) :
     game_board(game_board), value(value), parent(std::move(parent)), last_move(last_move),
-    terminal(game_board.is_over()) {
+    terminal(ZeroNode::game_board.is_over()) {
 
     for (const auto &[move, p] : priors) {
       branches.emplace(move, p);
@@ -89,16 +153,39 @@ namespace zero {
 
     assert((! branches.empty()) || terminal);
 
+    // A queen promotion without the knight promotion means that the underpromotions
+    // were left out.
+    all_moves = std::none_of(branches.begin(), branches.end(), [&](const auto& p) {
+      const auto& mv = p.first;
+      if (! mv.promote.is_queen())
+        return false;
+      const auto knight = mv.promote.color() == Color::white ? chess::Piece::WN : chess::Piece::BN;
+      return ! branches.contains(Move(mv.from, mv.to, mv.capture, knight, mv.flag));
+    });
+
     if (terminal) {
-      // Override the model's value estimate with actual result
-      auto winner = game_board.winner().value(); // NOLINT
-      if (winner == game_board.side)
-        // This is not possible, but we include this case for clarity
-        ZeroNode::value = 1.0;
-      else if (winner == Color::both)
-        ZeroNode::value = 0.0;
-      else
-        ZeroNode::value = -1.0;
+      // Override the model's value estimate with actual result.  The status is cached on
+      // the board from the is_over call above.  Checkmate is always a loss for the side
+      // to move, and anything else is a draw.
+      proven = ZeroNode::game_board.game_status() == chess::GameStatus::checkmate ? Proven::loss : Proven::draw;
+      ZeroNode::value = proven_value(proven);
+    }
+  }
+
+  ZeroNode::~ZeroNode() {
+    // Take over the children of each node that is only referenced from the tree, so
+    // it is destroyed with no children left and the recursion stops there.
+    std::vector<std::shared_ptr<ZeroNode>> stack;
+    for (auto& [move, child] : children)
+      stack.push_back(std::move(child));
+    while (! stack.empty()) {
+      auto node = std::move(stack.back());
+      stack.pop_back();
+      if (node.use_count() == 1) {
+        for (auto& [move, child] : node->children)
+          stack.push_back(std::move(child));
+        node->children.clear();
+      }
     }
   }
 
@@ -115,6 +202,44 @@ namespace zero {
     (it->second.total_value) += value;
   }
 
+  bool ZeroNode::update_proof(Move move, const ZeroNode& child) {
+    auto& branch = branches.find(move)->second;
+    branch.proven = opponent_result(child.proven);
+    branch.proven_plies = static_cast<std::uint16_t>(child.proven_plies + 1);
+    if (proven != Proven::unknown)
+      return false;
+
+    if (branch.proven == Proven::win) {
+      proven = Proven::win;
+      proven_plies = branch.proven_plies;
+      return true;
+    }
+    // No move wins, so the best is a draw if there is one, else the longest loss.
+    if (! all_moves)
+      return false;
+    std::uint16_t draw_plies = 0;
+    std::uint16_t loss_plies = 0;
+    bool draw = false;
+    for (const auto& [m, b] : branches) {
+      if (b.proven == Proven::unknown)
+        return false;
+      if (b.proven == Proven::draw) {
+        draw = true;
+        draw_plies = std::max(draw_plies, b.proven_plies);
+      }
+      else
+        loss_plies = std::max(loss_plies, b.proven_plies);
+    }
+    proven = draw ? Proven::draw : Proven::loss;
+    proven_plies = draw ? draw_plies : loss_plies;
+    return true;
+  }
+
+  size_t ZeroNode::bytes() const {
+    // make_shared allocates the node together with the reference counts.
+    return allocation_bytes(sizeof(ZeroNode) + 2 * sizeof(void*)) + map_bytes(branches) + map_bytes(children);
+  }
+
   float ZeroNode::expected_value(Move m, float fpu) const {
     auto branch = branches.find(m)->second;
     return branch.expected_value(fpu);
@@ -128,7 +253,7 @@ namespace zero {
   }
 
 
-  Move ZeroAgent::select_move(const chess::Board& game_board) {
+  Move ZeroAgent::select_move(const chess::Board& game_board, const chess::History& history) {
     const utils::Timer timer; // Could be moved into SearchInfo to expand access.
 
     // std::cerr << "In select move, prior move count: " << game_board.total_moves << std::endl;
@@ -138,57 +263,109 @@ namespace zero {
     // depth 1.  It was intended initially for self play (occurs at depth 1 if same
     // agent is used for both sides).  But then I discovered that LC0 disables tree-use
     // for selfplay.  So decided to remove it to simplify the code.
+
+    // Under "go infinite" the search runs until stopped, so it can't stop early.
+    const bool limited = info.have_time_limit || info.num_rounds > 0;
+    if (limited) {
+      const auto legal_moves = game_board.generate_legal_moves();
+      if (legal_moves.size() == 1)
+        return play_forced_move(game_board, legal_moves.front());
+    }
+
+    model_->new_search();
+    const auto start_cache_stats = model_->cache_stats();
+    tree_bytes_ = 0;
+    // Gumbel root selection needs a fixed number of playouts.
+    gumbel_root_ = info.gumbel && info.num_rounds > 0 && ! info.have_time_limit;
     auto root = create_node(game_board);
 
+    // Moves leading to the node being expanded.  The boards in the tree are created by
+    // copy-make, so this is what make_move uses to detect repetitions.  Positions before
+    // the last irreversible move can't repeat, so only that part of the game history is
+    // needed.
+    const auto window = std::min(static_cast<size_t>(game_board.fifty_move), history.size());
+    chess::History path(history.end() - static_cast<std::ptrdiff_t>(window), history.end());
+    const auto root_path_size = static_cast<std::ptrdiff_t>(path.size());
+
     int max_depth = 0;
     int cumulative_depth = 0;
     int round_number = 0;
+    long pruned_nodes = 0;
+    bool stopped_early = false;
+    std::vector<int> kld_visits;
+    std::optional<GumbelRoot> gumbel;
+    if (gumbel_root_)
+      gumbel.emplace(*root, info.num_rounds, info.gumbel_considered_moves,
+                     info.gumbel_c_visit, info.gumbel_c_scale, info.add_noise);
+    auto hashfull = [&]() -> std::optional<int> {
+      if (info.tree_memory_limit == 0)
+        return std::nullopt;
+      return static_cast<int>(std::min<size_t>(1000, tree_bytes_ * 1000 / info.tree_memory_limit));
+    };
     num_cache_hits_ = 0;
+    const auto start_counters = instrument::thread_counters;
+    trace::Scope search_scope("search");
     for (;;) {
       // std::cout << "Round: " << round_number << std::endl;
+      instrument::count(instrument::Event::playout);
+      instrument::PhaseTimer selection_timer(instrument::Phase::selection);
+      trace::Scope selection_scope("selection");
       int depth = 0;
       auto node = root;
       // debug_select_branch(*node, round_number);
-      auto next_move = select_branch(*node);
+      auto next_move = gumbel ? gumbel->select(*root, round_number) : select_branch(*node);
       ++depth;
       // std::cout << "Selected root move: " << next_move << std::endl;
       // for (auto it = node->children.find(next_move); it != node->children.end();) {
       for (std::unordered_map<Move, std::shared_ptr<ZeroNode>, MoveHash>::const_iterator it;
            it = node->children.find(next_move), it != node->children.end();) {
+        node->game_board.record_move(next_move, path);
         node = it->second;
-        if (node->terminal)
+        if (node->proven != Proven::unknown)
           break;
         next_move = select_branch(*node);
         ++depth;
       }
+      selection_timer.stop();
+      selection_scope.end();
       max_depth = std::max(max_depth, depth);
       cumulative_depth += depth;
 
       float value;
       std::optional<Move> move;
-      if (! node->terminal) {
+      if (node->proven == Proven::unknown) {
         auto new_board = node->game_board;
-        auto legal = new_board.make_move(next_move);
+        auto legal = new_board.make_move(next_move, path);
         assert(legal);
         auto child_node = create_node(new_board, next_move, node);
         value = -1 * child_node->value;
         move = next_move;
       }
       else {
-        value = node->value;
+        value = proven_value(node->proven);
       }
 
-      while (node) {
-        if (node->terminal)
-          (node->total_visit_count)++;
-        else
-          node->record_visit(move.value(), value); // NOLINT(bugprone-unchecked-optional-access)
-        move = node->last_move; // Will be null at root node
-        node = node->parent.lock();
-        value = -1 * value;
+      {
+        const instrument::PhaseTimer timer(instrument::Phase::backprop);
+        const trace::Scope scope("backprop");
+        backup(node, move, value);
       }
+      path.erase(path.begin() + root_path_size, path.end());
 
       ++round_number;
+      if (info.tree_memory_limit > 0 && tree_bytes_ >= info.tree_memory_limit) {
+        // Free a tenth of the limit, so that pruning is not needed at every playout.
+        const auto target_bytes = info.tree_memory_limit - info.tree_memory_limit / 10;
+        if (info.tree_memory_action == TreeMemoryAction::prune)
+          pruned_nodes += prune_tree(*root, target_bytes);
+        // If pruning can't free enough, the tree is mostly proven nodes and their
+        // ancestors, and it would be scanned again at every playout.  Stop instead.
+        if (tree_bytes_ > target_bytes) {
+          if (info.game_mode == GameMode::uci)
+            std::cout << "info string tree memory limit reached" << std::endl;
+          break;
+        }
+      }
       if (info.have_time_limit) {
         if (info.timer.elapsed() * 1000 > info.time_limit_ms)
           break;
@@ -197,33 +374,74 @@ namespace zero {
       if (info.game_mode == GameMode::uci && info.stop_flag_ptr_ && *info.stop_flag_ptr_)
         break;
 
+      if (limited) {
+        // A proven root needs no more playouts, except for experience, where the visits
+        // are the policy target.  Sequential halving needs all its playouts.
+        if ((root->proven != Proven::unknown && ! collector)
+            || (! gumbel && best_move_decided(*root, round_number))) {
+          stopped_early = true;
+          break;
+        }
+        if (! gumbel && info.kld_gain_threshold > 0 && round_number % info.kld_gain_interval == 0) {
+          auto visits = root_visits(*root);
+          if (! kld_visits.empty()
+              && visit_kl_divergence(kld_visits, visits) / info.kld_gain_interval < info.kld_gain_threshold) {
+            stopped_early = true;
+            break;
+          }
+          kld_visits = std::move(visits);
+        }
+      }
+
       if (info.game_mode == GameMode::uci && round_number % 1000 == 0) {
-        root->output_uci_info(cumulative_depth, max_depth, timer.elapsed());
+        root->output_uci_info(cumulative_depth, max_depth, timer.elapsed(), hashfull());
+        std::cout << "info string cache " << model_->cache_stats() - start_cache_stats << std::endl;
         if (info.live_move_stats)
           root->output_move_stats(info.get_fpu(*root), round_number);
       }
     }
 
+    search_scope.end();
+
+    last_search_ = {round_number, max_depth, cumulative_depth, num_cache_hits_, tree_bytes_, pruned_nodes, stopped_early};
+    if (stopped_early && info.have_time_limit)
+      info.saved_time_ms = std::max(0.0f, info.time_limit_ms - static_cast<float>(info.timer.elapsed() * 1000));
+    total_playouts_ += round_number;
+    total_evaluations_ += round_number - num_cache_hits_;
+
     if (collector) {
       auto root_state_tensor = encoder_->encode(game_board);
-      const std::vector<int64_t> visit_counts_shape {1, PRIOR_SHAPE[0], PRIOR_SHAPE[1], PRIOR_SHAPE[2]};
-      Tensor<float> visit_counts(visit_counts_shape);
+      PolicyTensor visit_counts;
+      // The Gumbel search records its improved policy instead, scaled to sum to the
+      // playouts like the visit counts.
+      std::unordered_map<Move, float, MoveHash> improved_policy;
+      if (gumbel) {
+        for (const auto& [mv, p] : gumbel->improved_policy(*root))
+          improved_policy.emplace(mv, p * static_cast<float>(round_number));
+      }
       auto get_visit_count = [&](Move mv) {
+        if (gumbel) {
+          auto it = improved_policy.find(mv);
+          return it != improved_policy.end() ? it->second : 0.0f;
+        }
         auto it = root->branches.find(mv);
         if (it != root->branches.end())
-          return it->second.visit_count;
+          return static_cast<float>(it->second.visit_count);
         else
-          return 0;
+          return 0.0f;
       };
       auto move_coord_map = encoder_->decode_legal_moves(game_board);
       for (const auto &[mv, coords] : move_coord_map) {
-        visit_counts.at({0, coords[0], coords[1], coords[2]}) =
-          static_cast<float>(get_visit_count(mv));
+        visit_counts.at(coords[0], coords[1], coords[2]) = get_visit_count(mv);
       }
-      collector->record_decision(std::move(root_state_tensor), std::move(visit_counts), game_board.side);
+      collector->record_decision(root_state_tensor, visit_counts, game_board.side);
     }
 
     auto best_move = [&](){
+      if (gumbel) {
+        // Sequential halving winner, which is sampled by the Gumbel noise
+        return gumbel->best_move(*root);
+      }
       if (game_board.total_moves >= info.num_randomized_moves) {
         // Select the move with the highest visit count
         return root->get_best_move();
@@ -241,31 +459,181 @@ namespace zero {
       }
     }();
 
-    if (info.game_mode == GameMode::uci)
-      root->output_uci_info(cumulative_depth, max_depth, timer.elapsed(), best_move);
-
-    if (info.debug >= 1) {
-      std::cout << "info string cache hits: " << num_cache_hits_ << std::endl;;
-      std::cout << "info string cache size: " << model_->cache_size() << std::endl;
+    if (info.game_mode == GameMode::uci) {
+      root->output_uci_info(cumulative_depth, max_depth, timer.elapsed(), hashfull(), best_move);
+      std::cout << "info string cache " << model_->cache_stats() - start_cache_stats << std::endl;
     }
 
+    if (instrument::ENABLED && info.game_mode == GameMode::uci)
+      (instrument::thread_counters - start_counters).write_uci_info(std::cout);
+
     if (info.verbose_move_stats) {
       root->output_move_stats(info.get_fpu(*root), round_number);
     }
 
+    // Free the tree off the caller's thread, so it doesn't delay the move.
+    reclaimer_.release(std::move(root));
     return best_move;
   }
 
+  Move ZeroAgent::play_forced_move(const chess::Board& game_board, Move move) {
+    last_search_ = {0, 0, 0, 0, 0, 0, true};
+    if (info.have_time_limit)
+      info.saved_time_ms = std::max(0.0f, info.time_limit_ms - static_cast<float>(info.timer.elapsed() * 1000));
+
+    if (collector) {
+      // One-hot visit target, as if the move had been searched once.
+      PolicyTensor visit_counts;
+      const auto coords = encoder_->decode_legal_moves(game_board).at(move);
+      visit_counts.at(coords[0], coords[1], coords[2]) = 1.0;
+      collector->record_decision(encoder_->encode(game_board), visit_counts, game_board.side);
+    }
+
+    if (info.game_mode == GameMode::uci)
+      std::cout << "info string single legal move" << std::endl;
+    return move;
+  }
+
+  TreeReclaimer::~TreeReclaimer() {
+    {
+      const std::lock_guard<std::mutex> lock(mtx_);
+      stopping_ = true;
+    }
+    cv_.notify_one();
+    if (thread_.joinable())
+      thread_.join();
+  }
+
+  void TreeReclaimer::release(std::shared_ptr<ZeroNode> root) {
+    if (! root)
+      return;
+    const std::lock_guard<std::mutex> lock(mtx_);
+    if (! thread_.joinable())
+      thread_ = std::thread(&TreeReclaimer::run, this);
+    queue_.push_back(std::move(root));
+    cv_.notify_one();
+  }
+
+  void TreeReclaimer::wait() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    idle_cv_.wait(lock, [this]{ return queue_.empty() && ! busy_; });
+  }
+
+  void TreeReclaimer::run() {
+    std::unique_lock<std::mutex> lock(mtx_);
+    for (;;) {
+      cv_.wait(lock, [this]{ return stopping_ || ! queue_.empty(); });
+      // Trees queued before stopping are still freed.
+      if (queue_.empty())
+        return;
+      auto root = std::move(queue_.front());
+      queue_.pop_front();
+      busy_ = true;
+      lock.unlock();
+      {
+        const trace::Scope scope("free_tree");
+        root.reset();
+      }
+      lock.lock();
+      busy_ = false;
+      if (queue_.empty())
+        idle_cv_.notify_all();
+    }
+  }
+
+  bool ZeroAgent::best_move_decided(const ZeroNode& root, int round_number) const {
+    if (info.smart_pruning_factor <= 0 || root.game_board.total_moves < info.num_randomized_moves)
+      return false;
+
+    double remaining;
+    if (info.have_time_limit) {
+      if (round_number < SMART_PRUNING_MIN_ROUNDS)
+        return false;
+      // Playouts left at the rate so far.  The elapsed time is at least 1 ms so that
+      // a coarse clock can't give a division by zero.
+      const auto elapsed_ms = std::max(info.timer.elapsed() * 1000, 1.0);
+      remaining = round_number * (info.time_limit_ms - elapsed_ms) / elapsed_ms;
+    }
+    else
+      remaining = info.num_rounds - round_number;
+
+    // As in get_best_move, a move proven to win is played at once, and the visits of
+    // moves proven to lose don't count.
+    int best = 0;
+    int second = 0;
+    for (const auto& [move, branch] : root.branches) {
+      if (branch.proven == Proven::win)
+        return true;
+      if (branch.proven == Proven::loss)
+        continue;
+      if (branch.visit_count > best) {
+        second = best;
+        best = branch.visit_count;
+      }
+      else if (branch.visit_count > second)
+        second = branch.visit_count;
+    }
+    return best - second > remaining / info.smart_pruning_factor;
+  }
+
+  void backup(std::shared_ptr<ZeroNode> node, std::optional<Move> move, float value) {
+    // Only a child created by this playout can be newly proven.  Its proof is passed up
+    // for as long as it proves the parent too.
+    const ZeroNode* child = nullptr;
+    if (move) {
+      auto it = node->children.find(*move);
+      if (it != node->children.end() && it->second->proven != Proven::unknown)
+        child = it->second.get();
+    }
+    while (node) {
+      if (! move)
+        (node->total_visit_count)++;
+      else {
+        node->record_visit(*move, value);
+        if (child && ! node->update_proof(*move, *child))
+          child = nullptr;
+      }
+      if (child)
+        child = node.get();
+      move = node->last_move; // Will be null at root node
+      node = node->parent.lock();
+      value = -1 * value;
+    }
+  }
+
   Move ZeroNode::get_best_move() const {
+    if (proven != Proven::unknown) {
+      auto rank = [](const Branch& b) {
+        switch (b.proven) {
+        case Proven::win: return 2 * UINT16_MAX - b.proven_plies;
+        case Proven::draw: return UINT16_MAX;
+        case Proven::loss: return static_cast<int>(b.proven_plies);
+        default: return -1;
+        }
+      };
+      return std::max_element(branches.begin(), branches.end(), [&](const auto& p1, const auto& p2) {
+        return rank(p1.second) < rank(p2.second);
+      })->first;
+    }
+    // Visits may have piled up on a move before it was proven to lose, so it is only
+    // played when every move loses, and then the longest loss.  A move proven to win
+    // is played at once.
+    auto rank = [](const Branch& b) {
+      switch (b.proven) {
+      case Proven::win: return std::make_pair(2, -static_cast<int>(b.proven_plies));
+      case Proven::loss: return std::make_pair(0, static_cast<int>(b.proven_plies));
+      default: return std::make_pair(1, b.visit_count);
+      }
+    };
     auto max_it = std::max_element(branches.begin(), branches.end(),
-                                   [](const auto& p1, const auto& p2) {
-                                     return p1.second.visit_count < p2.second.visit_count;
+                                   [&](const auto& p1, const auto& p2) {
+                                     return rank(p1.second) < rank(p2.second);
                                    });
     return max_it->first;
   }
 
-  void ZeroNode::output_uci_info(int cumulative_depth, int max_depth, double
-                                 time_seconds, std::optional<Move> best_move_opt) const {
+  void ZeroNode::output_uci_info(int cumulative_depth, int max_depth, double time_seconds,
+                                 std::optional<int> hashfull, std::optional<Move> best_move_opt) const {
 
     auto best_move = best_move_opt.value_or(get_best_move());
 
@@ -275,8 +643,18 @@ namespace zero {
     std::cout << " seldepth " << max_depth;
     std::cout << " time " << static_cast<int>(time_seconds * 1000);
     std::cout << " nodes " << node_count;
-    std::cout << " score cp " << branches.at(best_move).value_in_centipawns(0.0);
+    // Mate in moves, negative if the engine is mated.
+    if (proven == Proven::win)
+      std::cout << " score mate " << (proven_plies + 1) / 2;
+    else if (proven == Proven::loss)
+      std::cout << " score mate " << -(proven_plies / 2);
+    else if (proven == Proven::draw)
+      std::cout << " score cp 0";
+    else
+      std::cout << " score cp " << branches.at(best_move).value_in_centipawns(0.0);
     std::cout << " nps " << static_cast<int>(node_count / time_seconds);
+    if (hashfull)
+      std::cout << " hashfull " << *hashfull;
     std::cout << " pv " << best_move;
     std::cout << std::endl;
   }
@@ -295,6 +673,9 @@ namespace zero {
         std::cout << " (V: " << -child_it->second->value << ")";
       else
         std::cout << " (V:  -.----)";
+      if (b.proven != Proven::unknown)
+        std::cout << " (" << (b.proven == Proven::win ? "win" : b.proven == Proven::loss ? "loss" : "draw")
+                  << " in " << b.proven_plies << ")";
       std::cout << "\n";
     }
     std::cout << "info string node (" << branches.size() << ")";
@@ -348,7 +729,7 @@ namespace zero {
 
     // Set up local pointer to move_priors.  If not adding noise, then we can just point
     // to cache reference, otherwise we need to make a local copy and point to that.
-    const bool adding_noise = info.add_noise && !parent.lock() && !output.move_priors.empty();
+    const bool adding_noise = info.add_noise && ! gumbel_root_ && !parent.lock() && !output.move_priors.empty();
     priors_type move_priors;  // Only needed if copying.
     const priors_type* move_priors_ptr = adding_noise ? &move_priors : &output.move_priors;
 
@@ -357,18 +738,61 @@ namespace zero {
       add_noise_to_priors(move_priors);
     }
 
+    instrument::PhaseTimer alloc_timer(instrument::Phase::node_alloc);
     auto new_node = std::make_shared<ZeroNode>(game_board, output.value,
                                                *move_priors_ptr,
                                                parent,
                                                move);
+    alloc_timer.stop();
+    tree_bytes_ += new_node->bytes();
     auto parent_shared = parent.lock();
     if (parent_shared) {
       assert(move);
+      const auto parent_bytes = parent_shared->bytes();
       parent_shared->add_child(move.value(), new_node);
+      tree_bytes_ += parent_shared->bytes() - parent_bytes;
     }
     return new_node;
   }
 
+  long ZeroAgent::prune_tree(ZeroNode& root, size_t target_bytes) {
+    std::vector<ZeroNode*> nodes;
+    std::vector<ZeroNode*> stack = {&root};
+    while (! stack.empty()) {
+      auto* node = stack.back();
+      stack.pop_back();
+      for (const auto& [mv, child] : node->children) {
+        nodes.push_back(child.get());
+        stack.push_back(child.get());
+      }
+    }
+
+    // A node has fewer visits than its parent, so in this order the descendants of a
+    // node are freed before it, and a freed node is never visited.
+    std::sort(nodes.begin(), nodes.end(), [](const ZeroNode* n1, const ZeroNode* n2) {
+      return n1->total_visit_count < n2->total_visit_count;
+    });
+    long num_pruned = 0;
+    for (auto* node : nodes) {
+      if (tree_bytes_ <= target_bytes)
+        break;
+      // Proven nodes are kept, as the search won't expand them again, and so are
+      // their ancestors.
+      if (node->proven != Proven::unknown || ! node->children.empty())
+        continue;
+      auto parent = node->parent.lock();
+      assert(parent && node->last_move);
+      // The visit statistics stay in the parent's branch, and the node is created
+      // again if the search returns to it.
+      const auto parent_bytes = parent->bytes();
+      tree_bytes_ -= node->bytes();
+      parent->children.erase(*node->last_move);
+      tree_bytes_ -= parent_bytes - parent->bytes();
+      ++num_pruned;
+    }
+    return num_pruned;
+  }
+
   Move ZeroAgent::select_branch(const ZeroNode& node) const {
     auto fpu = info.get_fpu(node);
     auto score_branch = [&] (Branch branch) {
@@ -6,6 +6,12 @@
 #include <unordered_map>
 #include <algorithm>
 #include <atomic>
+#include <cstdint>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
 
 #include "encoder.h"
 #include "experience.h"
@@ -18,16 +24,44 @@ namespace zero {
 
   float value_to_centipawns(float val);
 
+  /// Game result with best play, for the side to move at a node, or for the side
+  /// making the move of a branch.
+  enum class Proven : std::int8_t {
+    unknown,
+    loss,
+    draw,
+    win,
+  };
+
+  /// The result for the other side.
+  inline Proven opponent_result(Proven result) {
+    switch (result) {
+    case Proven::loss: return Proven::win;
+    case Proven::win: return Proven::loss;
+    default: return result;
+    }
+  }
+
+  /// Exact value of a proven result.
+  inline float proven_value(Proven result) {
+    return result == Proven::win ? 1.0f : result == Proven::loss ? -1.0f : 0.0f;
+  }
+
   class Branch {
   public:
     float prior;
     int visit_count = 0;
     float total_value = 0.0;
+    Proven proven = Proven::unknown;
+    // Plies to the end of the game, including this move, if proven.
+    std::uint16_t proven_plies = 0;
 
   public:
     Branch(float prior) : prior(prior) {}
 
     float expected_value(float fpu) const {
+      if (proven != Proven::unknown)
+        return proven_value(proven);
       if (visit_count == 0) {
         // if (fpu != 0) std::cout << "FPU: " << fpu << "\n";
         return fpu;
@@ -56,11 +90,21 @@ namespace zero {
     // Running average of expected value of child branches.
     float expected_value_ = 0.0;
     bool terminal;
+    // Result with best play, set for terminal nodes and propagated up by backup.  The
+    // search doesn't expand proven nodes.
+    Proven proven = Proven::unknown;
+    std::uint16_t proven_plies = 0;
+    // Whether the branches cover every legal move.  Underpromotions are left out with
+    // SearchInfo::disable_underpromotion, and then the node can't be proven a loss or a
+    // draw, as an underpromotion might still do better.
+    bool all_moves = true;
 
     ZeroNode(const chess::Board& game_board, float value,
              const std::unordered_map<chess::Move, float, chess::MoveHash>& priors,
              std::weak_ptr<ZeroNode> parent,
              std::optional<chess::Move> last_move);
+    /// Frees the subtree iteratively, so that deep trees can't overflow the stack.
+    ~ZeroNode();
 
     void add_child(chess::Move move, const std::shared_ptr<ZeroNode>& child) {
       children.emplace(move, child);
@@ -68,6 +112,11 @@ namespace zero {
 
     void record_visit(chess::Move m, float val);
 
+    /// Record the result of the child reached by move m, which is proven.  The node is
+    /// a win if a move wins, and otherwise proven once all the legal moves are: a draw
+    /// if a move draws, else a loss.  Returns whether the node was proven by this.
+    bool update_proof(chess::Move m, const ZeroNode& child);
+
     float get_fpu() const;
     float expected_value(chess::Move m, float fpu) const;
     float get_visited_policy() const;
@@ -88,9 +137,18 @@ namespace zero {
       return total_visit_count - 1;
     }
 
+    /// Estimated heap memory of the node, its branches and its child pointers, but
+    /// not of the children themselves.
+    size_t bytes() const;
+
+    /// Most visited move, or if the node is proven the shortest win, a draw, or the
+    /// longest loss.  A move proven to win is played before any other, and a move
+    /// proven to lose only if every move does.
     chess::Move get_best_move() const;
     void output_move_stats(float fpu, int playouts) const;
+    /// hashfull is the tree memory use in permill of the limit, if there is one.
     void output_uci_info(int cumulative_depth, int max_depth, double time_seconds,
+                         std::optional<int> hashfull = std::nullopt,
                          std::optional<chess::Move> best_move=std::nullopt) const;
 
   };
@@ -100,6 +158,15 @@ namespace zero {
     none,
   };
 
+  /// What the search does when the tree reaches its memory limit.
+  enum class TreeMemoryAction {
+    stop,  // Stop the search
+    prune, // Free the least visited subtrees, which are expanded again if revisited
+  };
+
+  /// Parse "stop" or "prune".  Throws std::invalid_argument otherwise.
+  TreeMemoryAction parse_tree_memory_action(const std::string& name);
+
   struct SearchInfo {
     // Limit on number of playouts.  Negative number means no limit.
     int num_rounds = 800;
@@ -138,6 +205,32 @@ namespace zero {
 
     int nn_cache_size = 100000;
 
+    // Limit on the estimated memory of the search tree in bytes, or 0 for no limit.
+    size_t tree_memory_limit = 0;
+    TreeMemoryAction tree_memory_action = TreeMemoryAction::prune;
+
+    // Stop when the most visited root move can't be overtaken in the playouts left
+    // under the node or time limit, as in LC0's smart pruning.  The playouts left are
+    // divided by this factor, so 1 only stops when the move can't change and larger
+    // values stop sooner.  0 disables it.  Not used while moves are selected in
+    // proportion to visits.
+    float smart_pruning_factor = 0.0;
+    // Stop when the root visit distribution changed by less than this KL divergence
+    // per playout over the last kld_gain_interval playouts, or 0 to disable.
+    double kld_gain_threshold = 0.0;
+    int kld_gain_interval = 100;
+    // Select root moves by Gumbel AlphaZero sequential halving over num_rounds
+    // playouts, recording the improved policy as the experience target.  See
+    // GumbelRoot.  Gumbel noise, if add_noise is set, takes the place of Dirichlet noise
+    // and of proportional move selection.  Searches without a node limit use PUCT.
+    bool gumbel = false;
+    int gumbel_considered_moves = 16;
+    float gumbel_c_visit = 50.0;
+    float gumbel_c_scale = 0.1;
+    // Time left by a search that stopped early, which is added to the next time
+    // budget.
+    float saved_time_ms = 0.0;
+
     std::shared_ptr<std::atomic<bool>> stop_flag_ptr_;
 
     /// Set search time and start counting.
@@ -157,6 +250,57 @@ namespace zero {
   };
 
 
+  /// Back up the value of a playout from node to the root, where move is the branch
+  /// taken from node, or null if node is terminal, and value is from the perspective
+  /// of the side to move at node.
+  void backup(std::shared_ptr<ZeroNode> node, std::optional<chess::Move> move, float value);
+
+  /// Statistics of the last search.
+  struct SearchStats {
+    int rounds = 0;
+    int max_depth = 0;
+    long cumulative_depth = 0;
+    int cache_hits = 0;
+    /// Estimated tree memory at the end of the search
+    size_t tree_bytes = 0;
+    /// Nodes freed to stay under the tree memory limit
+    long pruned_nodes = 0;
+    /// Whether the search stopped before its node or time limit
+    bool stopped_early = false;
+  };
+
+
+  /// Frees search trees on a background thread, so that a search can return its move
+  /// without waiting for the tree to be destroyed.  The thread is started by the first
+  /// release.
+  class TreeReclaimer {
+  public:
+    TreeReclaimer() = default;
+    /// Frees the trees still queued before returning.
+    ~TreeReclaimer();
+
+    TreeReclaimer(const TreeReclaimer&) = delete;
+    TreeReclaimer& operator=(const TreeReclaimer&) = delete;
+
+    /// Hand over a tree.  It is freed once the other references to it are gone.
+    void release(std::shared_ptr<ZeroNode> root);
+
+    /// Wait until the trees released so far are freed.
+    void wait();
+
+  private:
+    void run();
+
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::condition_variable idle_cv_;
+    std::deque<std::shared_ptr<ZeroNode>> queue_;
+    bool busy_ = false;
+    bool stopping_ = false;
+    std::thread thread_;
+  };
+
+
   class ZeroAgent : public Agent {
 
     // Concentration parameter for dirichlet noise:
@@ -167,8 +311,18 @@ namespace zero {
     std::shared_ptr<Encoder> encoder_;
 
     std::shared_ptr<ExperienceCollector> collector;
+    std::shared_ptr<CacheTraceWriter> cache_trace_;
 
     int num_cache_hits_ = 0;
+    // Estimated memory of the current search tree
+    size_t tree_bytes_ = 0;
+    // Whether the current search selects root moves with GumbelRoot, which brings its
+    // own noise in place of the Dirichlet noise on the root priors.
+    bool gumbel_root_ = false;
+    SearchStats last_search_;
+    long total_playouts_ = 0;
+    long total_evaluations_ = 0;
+    TreeReclaimer reclaimer_;
 
   public:
     SearchInfo info;
@@ -178,10 +332,20 @@ namespace zero {
               std::shared_ptr<Encoder> encoder,
               SearchInfo info = SearchInfo()) :
       encoder_(encoder), info(info) {
-      model_ = std::make_shared<CachedInferenceModel>(model, encoder, info.nn_cache_size, info.policy_softmax_temp, info.disable_underpromotion);
+      set_model(model);
+    }
+
+    /// Replace the network, e.g. after the inference options change.  A null model
+    /// releases the current one.
+    void set_model(const std::shared_ptr<InferenceModel>& model) {
+      model_.reset();
+      if (model)
+        model_ = std::make_shared<CachedInferenceModel>(model, encoder_, info.nn_cache_size, info.policy_softmax_temp, info.disable_underpromotion);
+      if (model_)
+        model_->set_trace(cache_trace_);
     }
 
-    chess::Move select_move(const chess::Board&) override;
+    chess::Move select_move(const chess::Board&, const chess::History&) override;
 
     void set_search_time(std::optional<int> move_time_ms,
                          std::optional<int> time_left_ms,
@@ -200,12 +364,55 @@ namespace zero {
       collector = std::move(c);
     }
 
+    /// Network cache counters since the cache was created or cleared.
+    CacheStats cache_stats() const {
+      return model_->cache_stats();
+    }
+
+    /// Record the network cache lookups of all searches, see CacheTraceWriter.
+    void set_cache_trace(std::shared_ptr<CacheTraceWriter> trace) {
+      cache_trace_ = std::move(trace);
+      if (model_)
+        model_->set_trace(cache_trace_);
+    }
+
+    /// Empty the network cache, so that a search does not depend on earlier ones.
+    void clear_cache() {
+      model_->clear();
+    }
+
+    const SearchStats& last_search_stats() const {
+      return last_search_;
+    }
+
+    /// Playouts over all searches of the agent.
+    long total_playouts() const { return total_playouts_; }
+    /// Network evaluations, i.e., cache misses, over all searches of the agent.
+    long total_evaluations() const { return total_evaluations_; }
+
+    /// Wait until the trees of earlier searches are freed, e.g. before measuring memory.
+    void wait_for_teardown() {
+      reclaimer_.wait();
+    }
+
+    /// Select the branch to explore from the node by PUCT score.
+    chess::Move select_branch(const ZeroNode& node) const;
+
+    /// Whether the most visited root move can't change in the playouts left, after
+    /// round_number playouts.  See SearchInfo::smart_pruning_factor.
+    bool best_move_decided(const ZeroNode& root, int round_number) const;
+
   private:
     std::shared_ptr<ZeroNode> create_node(const chess::Board& b,
                                           std::optional<chess::Move> move = std::nullopt,
                                           const std::weak_ptr<ZeroNode>& parent = std::weak_ptr<ZeroNode>());
+    /// Play the only legal move without a search, recording it for experience with a
+    /// single visit.
+    chess::Move play_forced_move(const chess::Board& game_board, chess::Move move);
     void add_noise_to_priors(std::unordered_map<chess::Move, float, chess::MoveHash>& priors) const;
-    chess::Move select_branch(const ZeroNode& node) const;
+    /// Free the least visited nodes below the root until the tree is within
+    /// target_bytes, or until no more can be freed.  Returns the number of nodes freed.
+    long prune_tree(ZeroNode& root, size_t target_bytes);
     void debug_select_branch(const ZeroNode& node, int) const;
   };
 
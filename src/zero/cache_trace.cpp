@@ -0,0 +1,223 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "cache_trace.h"
+#include "cached_inference.h"
+
+namespace zero {
+
+  namespace {
+    constexpr char TRACE_HEADER[8] = {'D', 'L', 'C', 'T', 'R', 'A', 'C', '1'};
+  };
+
+  CacheTraceWriter::CacheTraceWriter(const std::string& path) : fout_(path, std::ios::out | std::ios::binary) {
+    if (! fout_)
+      throw std::runtime_error("unable to open file: " + path);
+    fout_.write(TRACE_HEADER, sizeof(TRACE_HEADER));
+    buffer_.reserve(BUFFER_SIZE);
+  }
+
+  CacheTraceWriter::~CacheTraceWriter() {
+    flush();
+  }
+
+  void CacheTraceWriter::flush() {
+    fout_.write(reinterpret_cast<const char*>(buffer_.data()),
+                static_cast<std::streamsize>(buffer_.size() * sizeof(uint64_t)));
+    fout_.flush();
+    buffer_.clear();
+  }
+
+  std::vector<uint64_t> read_cache_trace(const std::string& path) {
+    std::ifstream infile(path, std::ios::in | std::ios::binary);
+    if (! infile)
+      throw std::runtime_error("unable to open file: " + path);
+    char header[sizeof(TRACE_HEADER)];
+    if (! infile.read(header, sizeof(header)) || ! std::equal(header, header + sizeof(header), TRACE_HEADER))
+      throw std::runtime_error("not a cache trace: " + path);
+
+    std::vector<uint64_t> trace;
+    uint64_t record;
+    while (infile.read(reinterpret_cast<char*>(&record), sizeof(record)))
+      trace.push_back(record);
+    return trace;
+  }
+
+  namespace cache_sim {
+
+    bool Fifo::access(uint64_t key) {
+      if (keys_.contains(key))
+        return true;
+      while (keys_.size() >= capacity_) {
+        keys_.erase(queue_.front());
+        queue_.pop();
+      }
+      keys_.insert(key);
+      queue_.push(key);
+      return false;
+    }
+
+    bool Lru::access(uint64_t key) {
+      auto it = keys_.find(key);
+      if (it != keys_.end()) {
+        order_.splice(order_.begin(), order_, it->second);
+        return true;
+      }
+      while (keys_.size() >= capacity_) {
+        keys_.erase(order_.back());
+        order_.pop_back();
+      }
+      order_.push_front(key);
+      keys_.emplace(key, order_.begin());
+      return false;
+    }
+
+    bool Clock::access(uint64_t key) {
+      auto it = keys_.find(key);
+      if (it != keys_.end()) {
+        slots_[it->second].referenced = true;
+        return true;
+      }
+      if (slots_.size() < capacity_) {
+        keys_.emplace(key, slots_.size());
+        slots_.push_back({key, false});
+        return false;
+      }
+      while (slots_[hand_].referenced) {
+        slots_[hand_].referenced = false;
+        hand_ = (hand_ + 1) % slots_.size();
+      }
+      keys_.erase(slots_[hand_].key);
+      keys_.emplace(key, hand_);
+      slots_[hand_] = {key, false};
+      hand_ = (hand_ + 1) % slots_.size();
+      return false;
+    }
+
+    TwoQueue::TwoQueue(size_t capacity) :
+      Policy(capacity), in_capacity_(std::max<size_t>(capacity / 4, 1)), ghost_capacity_(std::max<size_t>(capacity / 2, 1)) {}
+
+    void TwoQueue::make_room() {
+      while (in_.size() + main_order_.size() >= capacity_) {
+        if (in_.size() > in_capacity_ || main_order_.empty()) {
+          // Oldest new key moves to the ghost list
+          const auto key = in_.back();
+          in_.pop_back();
+          in_keys_.erase(key);
+          ghost_.push_front(key);
+          ghost_keys_.emplace(key, ghost_.begin());
+          if (ghost_.size() > ghost_capacity_) {
+            ghost_keys_.erase(ghost_.back());
+            ghost_.pop_back();
+          }
+        }
+        else {
+          main_positions_.erase(main_order_.back());
+          main_order_.pop_back();
+        }
+      }
+    }
+
+    bool TwoQueue::access(uint64_t key) {
+      if (auto it = main_positions_.find(key); it != main_positions_.end()) {
+        main_order_.splice(main_order_.begin(), main_order_, it->second);
+        return true;
+      }
+      if (in_keys_.contains(key))
+        return true;
+
+      // Take the key out of the ghost list first, so that making room can't drop it.
+      const auto ghost = ghost_keys_.find(key);
+      const bool seen = ghost != ghost_keys_.end();
+      if (seen) {
+        ghost_.erase(ghost->second);
+        ghost_keys_.erase(ghost);
+      }
+      make_room();
+      if (seen) {
+        main_order_.push_front(key);
+        main_positions_.emplace(key, main_order_.begin());
+      }
+      else {
+        in_.push_front(key);
+        in_keys_.emplace(key, in_.begin());
+      }
+      return false;
+    }
+
+    bool Generation::access(uint64_t key) {
+      if (auto it = generations_.find(key); it != generations_.end()) {
+        it->second = generation_;
+        return true;
+      }
+      // Give each key at most one more pass, so that eviction terminates when all the
+      // keys are from the current search.
+      size_t num_skipped = 0;
+      while (generations_.size() >= capacity_) {
+        const auto front = queue_.front();
+        queue_.pop();
+        if (generations_[front] == generation_ && num_skipped < queue_.size()) {
+          queue_.push(front);
+          ++num_skipped;
+          continue;
+        }
+        generations_.erase(front);
+      }
+      generations_.emplace(key, generation_);
+      queue_.push(key);
+      return false;
+    }
+
+    struct ClockGeneration::Map : clock_map<bool> {
+      using clock_map<bool>::clock_map;
+    };
+
+    ClockGeneration::ClockGeneration(size_t capacity) : Policy(capacity), map_(std::make_unique<Map>(capacity)) {}
+
+    ClockGeneration::~ClockGeneration() = default;
+
+    bool ClockGeneration::access(uint64_t key) {
+      if (map_->find(key))
+        return true;
+      map_->insert(key, true);
+      return false;
+    }
+
+    void ClockGeneration::new_search() {
+      map_->new_generation();
+    }
+
+    std::unique_ptr<Policy> make_policy(const std::string& name, size_t capacity) {
+      if (capacity == 0)
+        throw std::invalid_argument("cache capacity must be positive");
+      if (name == "fifo")
+        return std::make_unique<Fifo>(capacity);
+      if (name == "lru")
+        return std::make_unique<Lru>(capacity);
+      if (name == "clock")
+        return std::make_unique<Clock>(capacity);
+      if (name == "2q")
+        return std::make_unique<TwoQueue>(capacity);
+      if (name == "generation")
+        return std::make_unique<Generation>(capacity);
+      if (name == "clock-generation")
+        return std::make_unique<ClockGeneration>(capacity);
+      throw std::invalid_argument("unknown cache policy: " + name);
+    }
+
+    Result simulate(const std::vector<uint64_t>& trace, Policy& policy) {
+      Result result;
+      for (auto record : trace) {
+        if (record == CacheTraceWriter::SEARCH_MARKER) {
+          policy.new_search();
+          continue;
+        }
+        ++result.lookups;
+        result.hits += policy.access(record);
+      }
+      return result;
+    }
+
+  };
+
+};
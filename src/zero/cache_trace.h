@@ -0,0 +1,179 @@
+#ifndef CACHE_TRACE_H
+#define CACHE_TRACE_H
+
+#include <cstdint>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace zero {
+
+  /// Records the keys looked up in the network cache, for replaying against other
+  /// cache sizes and eviction policies.
+  ///
+  /// The file is an 8 byte header followed by one little-endian uint64 per record.
+  /// A record is a lookup key, or SEARCH_MARKER at the start of each search, so
+  /// policies can tell the searches apart.  A key equal to the marker is recorded as 1.
+  class CacheTraceWriter {
+  public:
+    static constexpr uint64_t SEARCH_MARKER = 0;
+
+    explicit CacheTraceWriter(const std::string& path);
+    ~CacheTraceWriter();
+
+    CacheTraceWriter(const CacheTraceWriter&) = delete;
+    CacheTraceWriter& operator=(const CacheTraceWriter&) = delete;
+
+    void lookup(uint64_t key) {
+      buffer_.push_back(key == SEARCH_MARKER ? 1 : key);
+      if (buffer_.size() == BUFFER_SIZE)
+        flush();
+    }
+
+    void new_search() {
+      buffer_.push_back(SEARCH_MARKER);
+      if (buffer_.size() == BUFFER_SIZE)
+        flush();
+    }
+
+    void flush();
+
+  private:
+    static constexpr size_t BUFFER_SIZE = 1 << 16;
+    std::ofstream fout_;
+    std::vector<uint64_t> buffer_;
+  };
+
+  /// Records of a trace file, see CacheTraceWriter.
+  std::vector<uint64_t> read_cache_trace(const std::string& path);
+
+
+  /// Eviction policies for simulating the network cache on a trace.
+  namespace cache_sim {
+
+    /// Policies need a positive capacity.
+    class Policy {
+    public:
+      explicit Policy(size_t capacity) : capacity_(capacity) {}
+      virtual ~Policy() = default;
+
+      /// Look up the key, and insert it on a miss as the search does.  Returns whether
+      /// it was a hit.
+      virtual bool access(uint64_t key) = 0;
+      virtual void new_search() {}
+
+    protected:
+      size_t capacity_;
+    };
+
+    /// Evict in insertion order, as the network cache did before clock_map.
+    class Fifo : public Policy {
+    public:
+      using Policy::Policy;
+      bool access(uint64_t key) override;
+
+    private:
+      std::queue<uint64_t> queue_;
+      std::unordered_set<uint64_t> keys_;
+    };
+
+    /// Evict the least recently used key.
+    class Lru : public Policy {
+    public:
+      using Policy::Policy;
+      bool access(uint64_t key) override;
+
+    private:
+      std::list<uint64_t> order_;
+      std::unordered_map<uint64_t, std::list<uint64_t>::iterator> keys_;
+    };
+
+    /// Second chance: a hit sets a reference bit, and the hand clears bits until it
+    /// finds a key without one to evict.
+    class Clock : public Policy {
+    public:
+      using Policy::Policy;
+      bool access(uint64_t key) override;
+
+    private:
+      struct Slot {
+        uint64_t key;
+        bool referenced;
+      };
+      std::vector<Slot> slots_;
+      std::unordered_map<uint64_t, size_t> keys_;
+      size_t hand_ = 0;
+    };
+
+    /// Simplified 2Q: new keys enter a FIFO holding a quarter of the capacity, and keys
+    /// seen again after leaving it, which are remembered in a ghost list, go to an LRU.
+    class TwoQueue : public Policy {
+    public:
+      explicit TwoQueue(size_t capacity);
+      bool access(uint64_t key) override;
+
+    private:
+      void make_room();
+
+      size_t in_capacity_;
+      size_t ghost_capacity_;
+      std::list<uint64_t> in_;
+      std::unordered_map<uint64_t, std::list<uint64_t>::iterator> in_keys_;
+      std::list<uint64_t> ghost_;
+      std::unordered_map<uint64_t, std::list<uint64_t>::iterator> ghost_keys_;
+      std::list<uint64_t> main_order_;
+      std::unordered_map<uint64_t, std::list<uint64_t>::iterator> main_positions_;
+    };
+
+    /// FIFO that keeps keys used in the current search: a key at the front that was
+    /// accessed since the last new_search is moved to the back instead of evicted.
+    class Generation : public Policy {
+    public:
+      using Policy::Policy;
+      bool access(uint64_t key) override;
+      void new_search() override { ++generation_; }
+
+    private:
+      std::queue<uint64_t> queue_;
+      std::unordered_map<uint64_t, uint64_t> generations_;
+      uint64_t generation_ = 0;
+    };
+
+    /// CLOCK that protects the current generation, as the network cache does.  See
+    /// clock_map.
+    class ClockGeneration : public Policy {
+    public:
+      explicit ClockGeneration(size_t capacity);
+      ~ClockGeneration() override;
+      bool access(uint64_t key) override;
+      void new_search() override;
+
+    private:
+      struct Map;
+      std::unique_ptr<Map> map_;
+    };
+
+    inline const std::vector<std::string> POLICY_NAMES = {"fifo", "lru", "clock", "2q", "generation", "clock-generation"};
+
+    /// Throws std::invalid_argument for an unknown name or a zero capacity.
+    std::unique_ptr<Policy> make_policy(const std::string& name, size_t capacity);
+
+    struct Result {
+      uint64_t lookups = 0;
+      uint64_t hits = 0;
+
+      double hit_rate() const { return lookups ? static_cast<double>(hits) / static_cast<double>(lookups) : 0.0; }
+    };
+
+    Result simulate(const std::vector<uint64_t>& trace, Policy& policy);
+
+  };
+
+};
+
+#endif // CACHE_TRACE_H
@@ -1,7 +1,69 @@
+#include <cmath>
+#include <iomanip>
+
 #include "cached_inference.h"
+#include "../trace.h"
 
 namespace zero {
 
+  CacheStats CacheStats::operator-(const CacheStats& other) const {
+    auto result = *this;
+    result.hits -= other.hits;
+    result.misses -= other.misses;
+    result.evictions -= other.evictions;
+    return result;
+  }
+
+  std::ostream& operator<<(std::ostream& os, const CacheStats& stats) {
+    const auto flags = os.flags();
+    os << std::fixed << std::setprecision(1) << "hitrate " << 100.0 * stats.hit_rate() << "% hits " << stats.hits
+       << " misses " << stats.misses << " evictions " << stats.evictions << " size " << stats.size
+       << "/" << stats.capacity << " (" << 100.0 * stats.occupancy() << "% full)";
+    os.flags(flags);
+    return os;
+  }
+
+  void legal_move_softmax(const PolicyTensor& policy, std::span<const int64_t> indices,
+                          float temperature, std::vector<float>& priors) {
+    // Gather the logits and find the maximum in one pass.  Following LC0, subtract off
+    // the maximum.  This shouldn't change the result, but maybe it helps conditioning.
+    priors.resize(indices.size());
+    float pmax = -std::numeric_limits<float>::infinity();
+    for (size_t i=0; i<indices.size(); ++i) {
+      priors[i] = policy.data[indices[i]];
+      pmax = std::max(pmax, priors[i]);
+    }
+
+    float psum = 0.0;
+    for (auto& p : priors) {
+      p = std::exp((p - pmax) / temperature);
+      psum += p;
+    }
+
+    // Renormalize prior based on legal moves:
+    for (auto& p : priors)
+      p /= psum;
+  }
+
+  template <class Output>
+  float CachedInferenceModel::evaluate(const chess::Board& game_board, Output& output) {
+    using instrument::Phase;
+    if (model_->packed_input()) {
+      auto state_tensor = [&]() {
+        const instrument::PhaseTimer timer(Phase::encoding);
+        return encoder_->encode_packed(game_board);
+      }();
+      const instrument::PhaseTimer timer(Phase::inference);
+      return model_->operator()(state_tensor, encoder_->packed_size(), output);
+    }
+    auto state_tensor = [&]() {
+      const instrument::PhaseTimer timer(Phase::encoding);
+      return encoder_->encode(game_board);
+    }();
+    const instrument::PhaseTimer timer(Phase::inference);
+    return model_->operator()(state_tensor, encoder_->num_planes(), output);
+  }
+
   const NetworkOutput& CachedInferenceModel::operator() (const chess::Board& game_board,
                                          bool& cache_hit) {
     // Check cache:
@@ -12,61 +74,57 @@ namespace zero {
     auto hash = game_board.hash;
     hash = utils::HashCat(hash, game_board.repetition_count());
     hash = utils::HashCat(hash, game_board.fifty_move);
+    if (trace_)
+      trace_->lookup(hash);
 
-    if (cache_.contains(hash)) {
+    if (auto* output = cache_.find(hash)) {
       cache_hit = true;
-      return cache_.map_.at(hash);
+      instrument::count(instrument::Event::cache_hit);
+      return *output;
+    }
+    instrument::count(instrument::Event::cache_miss);
+    const trace::Scope scope("evaluate");
+
+    // Flattened policy indices of the moves that get a prior
+    {
+      const instrument::PhaseTimer timer(instrument::Phase::movegen);
+      auto move_coord_map = encoder_->decode_legal_moves(game_board);
+      moves_.clear();
+      legal_moves_.indices.clear();
+      for (const auto &[mv, coords] : move_coord_map) {
+        if (disable_underpromotion_ && mv.is_underpromotion())
+          continue;
+        moves_.push_back(mv);
+        legal_moves_.indices.push_back(PolicyTensor::index(coords[0], coords[1], coords[2]));
+      }
     }
 
-
-    // Prepare input and call neural net to get result:
-    auto state_tensor = encoder_->encode(game_board);
-
-    auto outputs = model_->operator()(state_tensor);
-
-    auto priors = &outputs[0]; // Shape: (1, 73, 8, 8)
-    auto values = &outputs[1]; // Shape: (1, 1)
-
-    const float value = values->at({0, 0});
-
+    // Prepare input and call neural net to get result.  A position without moves is
+    // over, so it gets the game result instead.
+    const float value = [&]() {
+      if (moves_.empty())
+        return game_board.game_status() == chess::GameStatus::checkmate ? -1.0f : 0.0f;
+      if (model_->legal_move_output())
+        return evaluate(game_board, legal_moves_);
+      return evaluate(game_board, policy_);
+    }();
+
+    const instrument::PhaseTimer timer(instrument::Phase::decoding);
+    if (! model_->legal_move_output() && ! moves_.empty())
+      legal_move_softmax(policy_, legal_moves_.indices, policy_softmax_temp_, legal_moves_.priors);
     priors_type move_priors;
-    auto move_coord_map = encoder_->decode_legal_moves(game_board);
-    for (const auto &[mv, coords] : move_coord_map) {
-      // std::cout << "move prior coords: " << mv << ": " << coords << std::endl;
-      if (disable_underpromotion_ && mv.is_underpromotion())
-        continue;
-      move_priors.emplace(mv, priors->at({0, coords[0], coords[1], coords[2]}));
-    }
+    move_priors.reserve(moves_.size());
+    for (size_t i=0; i<moves_.size(); ++i)
+      move_priors.emplace(moves_[i], legal_moves_.priors[i]);
 
-    if (! move_priors.empty()) {
-      // Apply softmax
-      // Following LC0, subtract off the maximum.  This shouldn't change the result, but
-      // maybe it helps conditioning.
-      auto pmax = std::max_element
-        (
-         std::begin(move_priors), std::end(move_priors),
-         [] (const auto& pair1, const auto& pair2) {
-           return pair1.second < pair2.second;
-         }
-         )->second;
-
-      for (auto &[mv, p]: move_priors)
-        p = exp((p - pmax) / policy_softmax_temp_);
+    cache_hit = false;
+    if (cache_.capacity() == 0) {
+      uncached_output_.emplace(std::move(move_priors), value);
+      return uncached_output_.value();
     }
 
-    // Renormalize prior based on legal moves:
-    const float psum = std::accumulate(move_priors.begin(), move_priors.end(), 0.0,
-                                       [](float value, const priors_type::value_type& p)
-                                       {return value + p.second;}
-                                       );
-    for (auto &[mv, p] : move_priors)
-      p /= psum;
-
-
     // Insert results into cache:
-    cache_hit = false;
-    cache_.insert(hash, std::move(NetworkOutput(std::move(move_priors), value)));
-    return cache_.map_.at(hash);
+    return cache_.insert(hash, NetworkOutput(std::move(move_priors), value));
   }
 
 };
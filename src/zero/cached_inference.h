@@ -1,11 +1,17 @@
 #ifndef CACHED_INFERENCE_H
 #define CACHED_INFERENCE_H
 
-#include <queue>
+#include <cassert>
+#include <ostream>
 #include <unordered_map>
+#include <vector>
+#include <span>
+#include <optional>
 
 #include "inference.h"
+#include "cache_trace.h"
 #include "../hashcat.h"
+#include "../instrument.h"
 
 
 namespace zero {
@@ -19,55 +25,217 @@ namespace zero {
     NetworkOutput(priors_type p, float v) : move_priors(std::move(p)), value(v) {}
   };
 
+  /// Cache counters since construction or the last clear.
+  struct CacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+    size_t size = 0;
+    size_t capacity = 0;
+
+    double hit_rate() const {
+      return hits + misses ? static_cast<double>(hits) / static_cast<double>(hits + misses) : 0.0;
+    }
+    double occupancy() const {
+      return capacity ? static_cast<double>(size) / static_cast<double>(capacity) : 0.0;
+    }
+
+    /// Counts since an earlier snapshot, with the current size.
+    CacheStats operator-(const CacheStats&) const;
+  };
+
+  std::ostream& operator<<(std::ostream&, const CacheStats&);
+
+  /// Fixed capacity map with CLOCK eviction that protects the current generation.
+  ///
+  /// Entries are stored in a ring that an eviction hand sweeps.  An entry is skipped
+  /// if it was used in the current generation, which is a search, so positions near
+  /// the root survive the search.  Otherwise an entry that was hit gets a second
+  /// chance: the hand clears its reference bit and moves on.  Once the current
+  /// generation fills the map, only the reference bits count.
+  ///
+  /// References returned by find and insert are valid until the next insert.
   template <class T>
-  struct fifo_map {
-    int max_size_;
-    std::queue<uint64_t> queue_;
-    std::unordered_map<uint64_t, NetworkOutput> map_;
+  class clock_map {
+  public:
+    explicit clock_map(size_t capacity) : capacity_(capacity) {
+      index_.reserve(capacity);
+    }
+
+    /// The value of the key, marked as used in the current generation, or nullptr.
+    T* find(uint64_t key) {
+      auto it = index_.find(key);
+      if (it == index_.end()) {
+        ++stats_.misses;
+        return nullptr;
+      }
+      ++stats_.hits;
+      auto& entry = entries_[it->second];
+      entry.referenced = true;
+      touch(entry);
+      return &entry.value;
+    }
+
+    /// Insert a key that is not in the map, evicting an entry if it is full.
+    T& insert(uint64_t key, T value) {
+      assert(capacity_ > 0 && ! index_.contains(key));
+      size_t slot;
+      if (entries_.size() < capacity_) {
+        slot = entries_.size();
+        entries_.push_back({key, generation_, false, std::move(value)});
+      }
+      else {
+        slot = evict();
+        auto& entry = entries_[slot];
+        index_.erase(entry.key);
+        entry.key = key;
+        entry.referenced = false;
+        entry.value = std::move(value);
+        ++stats_.evictions;
+        instrument::count(instrument::Event::cache_eviction);
+      }
+      ++num_current_;
+      entries_[slot].generation = generation_;
+      index_.emplace(key, slot);
+      return entries_[slot].value;
+    }
+
+    /// Start a new generation, so that no entry is protected until it is used again.
+    void new_generation() {
+      ++generation_;
+      num_current_ = 0;
+    }
 
-    fifo_map(int max_size) : max_size_(max_size) {
-      map_.reserve(max_size);
+    void clear() {
+      entries_.clear();
+      index_.clear();
+      hand_ = 0;
+      num_current_ = 0;
+      stats_ = {};
     }
 
-    bool contains(uint64_t key) {
-      return map_.contains(key);
+    size_t size() const { return entries_.size(); }
+    size_t capacity() const { return capacity_; }
+
+    CacheStats stats() const {
+      auto stats = stats_;
+      stats.size = entries_.size();
+      stats.capacity = capacity_;
+      return stats;
     }
 
-    void insert(uint64_t key, T value) {
-      while (map_.size() >= max_size_) {
-        map_.erase(queue_.front());
-        queue_.pop();
+  private:
+    struct Entry {
+      uint64_t key;
+      uint64_t generation;
+      bool referenced;
+      T value;
+    };
+
+    void touch(Entry& entry) {
+      if (entry.generation != generation_) {
+        entry.generation = generation_;
+        ++num_current_;
       }
-      map_.emplace(std::make_pair(key, std::move(value)));
-      queue_.push(key);
     }
 
+    /// Slot of the entry to evict.  The entry leaves the current generation count.
+    size_t evict() {
+      for (;;) {
+        auto& entry = entries_[hand_];
+        const auto slot = hand_;
+        hand_ = (hand_ + 1) % entries_.size();
+        const bool current = entry.generation == generation_;
+        if (current && num_current_ < entries_.size())
+          continue;
+        if (entry.referenced) {
+          entry.referenced = false;
+          continue;
+        }
+        if (current)
+          --num_current_;
+        return slot;
+      }
+    }
+
+    size_t capacity_;
+    std::vector<Entry> entries_;
+    std::unordered_map<uint64_t, size_t> index_;
+    size_t hand_ = 0;
+    uint64_t generation_ = 0;
+    /// Entries used in the current generation
+    size_t num_current_ = 0;
+    CacheStats stats_;
   };
 
 
+  /// Softmax with temperature of the policy logits at the given indices.
+  void legal_move_softmax(const PolicyTensor& policy, std::span<const int64_t> indices,
+                          float temperature, std::vector<float>& priors);
+
+
   class CachedInferenceModel {
 
     std::shared_ptr<InferenceModel> model_;
     std::shared_ptr<Encoder> encoder_;
 
-    fifo_map<NetworkOutput> cache_;
+    clock_map<NetworkOutput> cache_;
+    // Result of the last evaluation when the cache is disabled
+    std::optional<NetworkOutput> uncached_output_;
+    std::shared_ptr<CacheTraceWriter> trace_;
 
     bool disable_underpromotion_;
     float policy_softmax_temp_;
 
+    // Scratch space reused across evaluations
+    std::vector<chess::Move> moves_;
+    LegalMoves legal_moves_;
+    PolicyTensor policy_;
+
+    /// Encode the board as the network expects and evaluate it, where Output is
+    /// PolicyTensor or LegalMoves depending on the network signature.
+    template <class Output>
+    float evaluate(const chess::Board&, Output& output);
+
   public:
 
+    /// A cache size of zero disables the cache, in which case the result of operator()
+    /// is valid until the next call.
     CachedInferenceModel(std::shared_ptr<InferenceModel> model,
                          std::shared_ptr<Encoder> encoder,
                          int cache_size,
                          float policy_softmax_temp,
                          bool disable_underpromotion) :
       model_(std::move(model)), encoder_(std::move(encoder)), cache_(cache_size),
-      policy_softmax_temp_(policy_softmax_temp), disable_underpromotion_(disable_underpromotion) {}
+      policy_softmax_temp_(policy_softmax_temp), disable_underpromotion_(disable_underpromotion) {
+      // Networks with the legal-move signature apply the temperature in the graph.
+      legal_moves_.temperature = policy_softmax_temp_;
+    }
 
     // Get current size of cache
     size_t cache_size() const {
-      return cache_.map_.size();
+      return cache_.size();
+    }
+
+    CacheStats cache_stats() const {
+      return cache_.stats();
+    }
+
+    void clear() {
+      cache_.clear();
+    }
+
+    /// Record the keys of all lookups in the trace, or stop recording if null.
+    void set_trace(std::shared_ptr<CacheTraceWriter> trace) {
+      trace_ = std::move(trace);
+    }
+
+    /// Called at the start of each search, to start a cache generation and mark it in
+    /// the trace.
+    void new_search() {
+      cache_.new_generation();
+      if (trace_)
+        trace_->new_search();
     }
 
     // Get a neural network result, possibly using the cache.
@@ -1,4 +1,9 @@
 #include <bitset>
+#include <algorithm>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 
 #include "../chess/transform.h"
 #include "encoder.h"
@@ -19,89 +24,179 @@ namespace {
     return transform;
   }
 
+  constexpr int PLANE_SIZE = GRID_SIZE * GRID_SIZE;
+
+  /// Write each bit of the bitboard as 0.0 or 1.0, with square sq at out[sq].
+  void expand_bitboard(uint64_t bb, float* out) {
+#ifdef __AVX2__
+    // Broadcast one rank to eight lanes and test a different bit in each lane.
+    const __m256i bit_mask = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+    const __m256 one = _mm256_set1_ps(1.0);
+    for (int rank=0; rank<GRID_SIZE; ++rank) {
+      const __m256i bits = _mm256_set1_epi32(static_cast<int>((bb >> (GRID_SIZE * rank)) & 0xFF));
+      const __m256i set = _mm256_cmpeq_epi32(_mm256_and_si256(bits, bit_mask), bit_mask);
+      _mm256_storeu_ps(out + GRID_SIZE * rank, _mm256_and_ps(_mm256_castsi256_ps(set), one));
+    }
+#else
+    for (int sq=0; sq<PLANE_SIZE; ++sq)
+      out[sq] = static_cast<float>((bb >> sq) & 1);
+#endif
+  }
+
+  void fill_plane(float* out, float val) {
+#ifdef __AVX2__
+    const __m256 vals = _mm256_set1_ps(val);
+    for (int i=0; i<PLANE_SIZE; i+=8)
+      _mm256_storeu_ps(out + i, vals);
+#else
+    std::fill_n(out, PLANE_SIZE, val);
+#endif
+  }
+
 };
 
 
 namespace zero {
-  
-  Tensor<float> SimpleEncoder::encode(const chess::Board& b) const {
-    const int num_planes = en_passant_ ? 22 : 21;
-    const std::vector<int64_t> board_tensor_shape = {1, num_planes, GRID_SIZE, GRID_SIZE};
-    auto board_tensor = Tensor<float>(board_tensor_shape);
+
+  void Encoder::encode_batch(std::span<const chess::Board> boards, float* out) const {
+    const auto board_size = static_cast<size_t>(num_planes()) * PLANE_SIZE;
+    for (const auto& b : boards) {
+      encode(b, out);
+      out += board_size;
+    }
+  }
+
+  InputTensor Encoder::encode(const chess::Board& b) const {
+    assert(num_planes() <= MAX_INPUT_PLANES);
+    InputTensor board_tensor;
+    encode(b, board_tensor.data.data());
+    return board_tensor;
+  }
+
+  void Encoder::encode_packed_batch(std::span<const chess::Board> boards, uint8_t* out) const {
+    const auto board_size = static_cast<size_t>(packed_size());
+    for (const auto& b : boards) {
+      encode_packed(b, out);
+      out += board_size;
+    }
+  }
+
+  PackedInputTensor Encoder::encode_packed(const chess::Board& b) const {
+    assert(packed_size() <= PACKED_INPUT_SIZE);
+    PackedInputTensor board_tensor;
+    encode_packed(b, board_tensor.data.data());
+    return board_tensor;
+  }
+
+  SimpleEncoder::Features SimpleEncoder::features(const chess::Board& b) const {
+    Features f;
 
     Transform transform;
     if (orient_board_)
       transform = choose_transform(b);
     bool have_transform = transform.any();
 
-    // First 12 planes encode piece occupation
-    for (int plane=0; plane<chess::NUM_PIECE_TYPES_BOTH; ++plane) {
+    // Piece occupation
+    for (int idx=0; idx<chess::NUM_PIECE_TYPES_BOTH; ++idx) {
       auto piece_idx = [&](){
         // Note: this check may need to be updated if choose_transform is updated.
         if (have_transform) {
           // Arrange so that planes 0-5 have "our pieces" and 6-11 have "their pieces".
-          if (plane < 6)
-            return plane + 6;  // Swap white -> black pieces
-          return plane - 6; // Swap black -> white pieces
+          if (idx < 6)
+            return idx + 6;  // Swap white -> black pieces
+          return idx - 6; // Swap black -> white pieces
         }
-        return plane;
+        return idx;
       }();
 
       auto bb = b.bitboards[static_cast<int>(piece_idx)];
       if (have_transform)
         bb = chess::transform_bitboard(bb, transform);
-      for (auto sq : bb) {
-        auto coords = chess::sq_to_rf(sq);
-        board_tensor.at({0, plane, coords[0], coords[1]}) = 1.0;
-      }
+      f.bitboards[idx] = bb.to_ullong();
     }
 
-    // Next two planes are flags for one and two repetitions.
+    // En passant
+    f.bitboards.back() = 0;
+    if (b.en_pas != chess::Position::none)
+      f.bitboards.back() = 1ULL << chess::transform_square(b.en_pas, transform);
+
     auto repetitions = b.repetition_count();
-    if (repetitions >= 1)
-      board_tensor.fill_channel(0, 12, 1.0);
-    if (repetitions >= 2)
-      board_tensor.fill_channel(0, 13, 1.0);
+    f.repeated_once = repetitions >= 1;
+    f.repeated_twice = repetitions >= 2;
+    f.black_to_move = b.side == chess::Color::black;
+
+    if (b.side == chess::Color::white || ! orient_board_)
+      f.castling = {b.castle_perm[castling::WK], b.castle_perm[castling::WQ],
+                    b.castle_perm[castling::BK], b.castle_perm[castling::BQ]};
+    else
+      // Orient permissions for black to move
+      f.castling = {b.castle_perm[castling::BK], b.castle_perm[castling::BQ],
+                    b.castle_perm[castling::WK], b.castle_perm[castling::WQ]};
+
+    f.fifty_move = b.fifty_move;
+    return f;
+  }
+
+  void SimpleEncoder::encode(const chess::Board& b, float* out) const {
+    auto plane = [&](int idx) { return out + idx * PLANE_SIZE; };
+    const auto f = features(b);
+
+    // First 12 planes encode piece occupation
+    for (int idx=0; idx<chess::NUM_PIECE_TYPES_BOTH; ++idx)
+      expand_bitboard(f.bitboards[idx], plane(idx));
+
+    // Next two planes are flags for one and two repetitions.
+    fill_plane(plane(12), f.repeated_once);
+    fill_plane(plane(13), f.repeated_twice);
 
     // Color of side to move
-    if (b.side == chess::Color::black)
-      board_tensor.fill_channel(0, 14, 1.0);
+    fill_plane(plane(14), f.black_to_move);
 
     // Constant plane, to help with edge detection.  Was originally used for
     // total move count.
-    board_tensor.fill_channel(0, 15, 1.0);
+    fill_plane(plane(15), 1.0);
 
     // Castling
-    if (b.side == chess::Color::white || ! orient_board_) {
-      board_tensor.fill_channel(0, 16, b.castle_perm[castling::WK]);
-      board_tensor.fill_channel(0, 17, b.castle_perm[castling::WQ]);
-      board_tensor.fill_channel(0, 18, b.castle_perm[castling::BK]);
-      board_tensor.fill_channel(0, 19, b.castle_perm[castling::BQ]);
-    }
-    else {
-      // Orient permissions for black to move
-      board_tensor.fill_channel(0, 16, b.castle_perm[castling::BK]);
-      board_tensor.fill_channel(0, 17, b.castle_perm[castling::BQ]);
-      board_tensor.fill_channel(0, 18, b.castle_perm[castling::WK]);
-      board_tensor.fill_channel(0, 19, b.castle_perm[castling::WQ]);
-    }
+    for (int i=0; i<4; ++i)
+      fill_plane(plane(16 + i), f.castling[i]);
 
     // No progress count
     if (scale_move_count_)
-      board_tensor.fill_channel(0, 20, static_cast<float>(b.fifty_move) / 100.0);
+      fill_plane(plane(20), static_cast<float>(f.fifty_move) / 100.0);
     else
-      board_tensor.fill_channel(0, 20, static_cast<float>(b.fifty_move));
+      fill_plane(plane(20), static_cast<float>(f.fifty_move));
 
     // En passant
-    if (en_passant_ && b.en_pas != chess::Position::none) {
-      auto coords = chess::sq_to_rf(chess::transform_square(b.en_pas, transform));
-      board_tensor.at({0, 21, coords[0], coords[1]}) = 1.0;
-    }
+    if (en_passant_)
+      expand_bitboard(f.bitboards.back(), plane(21));
+  }
 
-    return board_tensor;
+  int SimpleEncoder::packed_size() const {
+    // Bitboards and 8 scalars
+    static_assert((chess::NUM_PIECE_TYPES_BOTH + 1) * GRID_SIZE + 8 == PACKED_INPUT_SIZE);
+    return PACKED_INPUT_SIZE;
   }
 
-  const std::array<int, 3> PRIOR_SHAPE = {73, 8, 8};
+  // The layout must match UnpackInput in nn/packed_input.py.  The plane order is the
+  // same as encode(), except that the constant plane is implied and the en passant
+  // bitboard is always present.  Scaling of the no-progress count is done in the
+  // network.
+  void SimpleEncoder::encode_packed(const chess::Board& b, uint8_t* out) const {
+    const auto f = features(b);
+
+    // Bitboards, one byte per rank
+    for (auto bb : f.bitboards) {
+      for (int rank=0; rank<GRID_SIZE; ++rank)
+        *out++ = static_cast<uint8_t>(bb >> (GRID_SIZE * rank));
+    }
+
+    *out++ = f.repeated_once;
+    *out++ = f.repeated_twice;
+    *out++ = f.black_to_move;
+    for (auto perm : f.castling)
+      *out++ = perm;
+    *out++ = static_cast<uint8_t>(std::min(f.fifty_move, 255));
+  }
 
   // Given the board state, construct a map from legal moves to coordinates
   // associated with the tensor encoding.
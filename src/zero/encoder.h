@@ -2,6 +2,7 @@
 #define ENCODER_H
 
 #include <vector>
+#include <span>
 #include <unordered_map>
 
 #include "tensor.h"
@@ -10,9 +11,45 @@
 
 namespace zero {
 
+  constexpr std::array<int, 3> PRIOR_SHAPE = {73, 8, 8};
+
+  /// Number of planes of the largest encoding.
+  constexpr int MAX_INPUT_PLANES = 22;
+  /// Number of bytes of the packed encoding.
+  constexpr int PACKED_INPUT_SIZE = 112;
+
+  using InputTensor = Tensor<float, MAX_INPUT_PLANES, chess::GRID_SIZE, chess::GRID_SIZE>;
+  using PackedInputTensor = Tensor<uint8_t, PACKED_INPUT_SIZE>;
+  using PolicyTensor = Tensor<float, PRIOR_SHAPE[0], PRIOR_SHAPE[1], PRIOR_SHAPE[2]>;
+
   class Encoder {
   public:
-    virtual Tensor<float> encode(const chess::Board&) const = 0;
+    /// Number of input planes per position.
+    virtual int num_planes() const = 0;
+
+    /// Encode a position into out[0 : num_planes() * 64], which the caller owns.
+    /// Every element is written, so the buffer need not be cleared.
+    virtual void encode(const chess::Board&, float* out) const = 0;
+
+    /// Encode boards into a contiguous [N, C, 8, 8] buffer owned by the caller.
+    void encode_batch(std::span<const chess::Board> boards, float* out) const;
+
+    /// Encode a single position.  Planes beyond num_planes() are zero.
+    InputTensor encode(const chess::Board&) const;
+
+    /// Number of bytes per position in the packed encoding.
+    virtual int packed_size() const = 0;
+
+    /// Compact alternative to encode(), for networks that expand the input planes
+    /// themselves (see nn/packed_input.py).  Writes out[0 : packed_size()].
+    virtual void encode_packed(const chess::Board&, uint8_t* out) const = 0;
+
+    /// Encode boards into a contiguous [N, packed_size()] buffer owned by the caller.
+    void encode_packed_batch(std::span<const chess::Board> boards, uint8_t* out) const;
+
+    /// Encode a single position in the packed format.
+    PackedInputTensor encode_packed(const chess::Board&) const;
+
     virtual std::unordered_map<chess::Move, std::array<int,3>, chess::MoveHash>
     decode_legal_moves(const chess::Board&) const = 0;
   };
@@ -21,17 +58,35 @@ namespace zero {
     bool en_passant_;
     bool orient_board_;
     bool scale_move_count_;
+
+    /// Contents of the input planes, after orienting the board.
+    struct Features {
+      /// The 12 piece bitboards in plane order, then the en passant square.
+      std::array<uint64_t, chess::NUM_PIECE_TYPES_BOTH + 1> bitboards;
+      bool repeated_once;
+      bool repeated_twice;
+      bool black_to_move;
+      /// Castling permissions in plane order.
+      std::array<bool, 4> castling;
+      int fifty_move;
+    };
+
+    Features features(const chess::Board&) const;
+
   public:
     SimpleEncoder(int version=1) : en_passant_{version >= 1},
                                    orient_board_{version >= 2},
                                    scale_move_count_{version >= 2} {}
-    Tensor<float> encode(const chess::Board&) const override;
+    int num_planes() const override { return en_passant_ ? 22 : 21; }
+    using Encoder::encode;
+    void encode(const chess::Board&, float* out) const override;
+    int packed_size() const override;
+    using Encoder::encode_packed;
+    void encode_packed(const chess::Board&, uint8_t* out) const override;
     std::unordered_map<chess::Move, std::array<int,3>, chess::MoveHash>
     decode_legal_moves(const chess::Board&) const override;
   };
 
-  extern const std::array<int, 3> PRIOR_SHAPE;
-
 };
 
 
@@ -1,47 +1,52 @@
 #include <fstream>
 #include <filesystem>
-#include <typeinfo>
+#include <numeric>
+#include <functional>
+#include <type_traits>
 
 #include "experience.h"
+#include "../trace.h"
 
 namespace zero {
 
   namespace {
 
-    void write_metadata(const std::vector<Tensor<float>>& tensors, const std::string& directory, const std::string& name) {
+    template <class T>
+    constexpr const char* dtype_name() {
+      if constexpr (std::is_same_v<T, float>)
+        return "float32";
+      else if constexpr (std::is_same_v<T, int16_t>)
+        return "int16";
+      else if constexpr (std::is_same_v<T, int32_t>)
+        return "int32";
+      else
+        static_assert(sizeof(T) == 0, "unexpected tensor dtype");
+    }
 
-      // We assume that each entry in the collection is a tensor containing a
-      // single item.  This allows us to determine the total length of the first
-      // axis as the number of items in the vector.
-      for (const auto& tensor : tensors)
-        assert(tensor.shape[0] == 1);
+    /// Write metadata for num_records records of the given shape, concatenated along
+    /// a new first axis.
+    template <class T>
+    void write_metadata(size_t num_records, const std::vector<int64_t>& record_shape,
+                        const std::string& directory, const std::string& name) {
 
-      if (tensors.empty())
-        return;
+      std::vector<int64_t> shape = {static_cast<int64_t>(num_records)};
+      shape.insert(shape.end(), record_shape.begin(), record_shape.end());
+      const int dim = shape.size();
+
+      std::vector<int64_t> strides(dim, 1);
+      for (int i=dim-2; i>=0; --i)
+        strides[i] = strides[i+1] * shape[i+1];
 
       auto json_path = std::filesystem::path(directory) / (name + ".json");
-      auto dim = tensors[0].dim();
 
       std::ofstream fout(json_path, std::ios::out);
       fout << "{\n  \"data\": \"" << name << ".dat" << "\",\n";
 
-      fout << R"(  "dtype": ")";
-      if (typeid(tensors[0]) == typeid(Tensor<float>))
-        fout << "float32";
-      else if (typeid(tensors[0]) == typeid(Tensor<int16_t>))
-        fout << "int16";
-      else if (typeid(tensors[0]) == typeid(Tensor<int32_t>))
-        fout << "int32";
-      else
-        throw std::runtime_error("unexpected tensor dtype");
-      fout << "\",\n";
+      fout << R"(  "dtype": ")" << dtype_name<T>() << "\",\n";
 
       fout << "  \"shape\": [";
       for (auto i=0; i<dim; ++i) {
-        if (i == 0)
-          fout << tensors.size();
-        else
-          fout << tensors[0].shape[i];
+        fout << shape[i];
         if (i + 1 < dim)
           fout << ", ";
       }
@@ -49,7 +54,7 @@ namespace zero {
 
       fout << "  \"strides\": [";
       for (auto i=0; i<dim; ++i) {
-        fout << tensors[0].strides[i];
+        fout << strides[i];
         if (i+1 < dim)
           fout << ", ";
       }
@@ -60,67 +65,37 @@ namespace zero {
       fout.close();
     }
 
-    // Overload for handling case where the data are stored in a simple vector
-    // (i.e., the actual data are scalars, so the collection of records is just
-    // one-dimensional).
-    void write_metadata(const std::vector<float>& vec, const std::string& directory, const std::string& name) {
-
+    // Serialize a vector of scalars, so the collection of records is just
+    // one-dimensional.
+    void serialize_vector(const std::vector<float>& vec, const std::string& directory, const std::string&name) {
       if (vec.empty())
         return;
 
-      auto json_path = std::filesystem::path(directory) / (name + ".json");
-
-      std::ofstream fout(json_path, std::ios::out);
-      fout << "{\n  \"data\": \"" << name << ".dat" << "\",\n";
-
-      fout << R"(  "dtype": ")";
-      if (typeid(vec) == typeid(std::vector<float>))
-        fout << "float32";
-      else if (typeid(vec) == typeid(std::vector<int16_t>))
-        fout << "int16";
-      else if (typeid(vec) == typeid(std::vector<int32_t>))
-        fout << "int32";
-      else
-        throw std::runtime_error("unexpected tensor dtype");
-      fout << "\",\n";
-
-      fout << "  \"shape\": [";
-      fout << vec.size();
-      fout << "],\n";
-
-      fout << "  \"strides\": [";
-      fout << 1;
-      // Note: no trailing comma for pure json compatibility
-      fout << "]\n";
-      fout << "}\n";
-
-      fout.close();
-    }
-
-    void serialize_vector(std::vector<float>& vec, const std::string& directory, const std::string&name) {
-      if (vec.empty())
-        return;
-
-      write_metadata(vec, directory, name);
+      write_metadata<float>(vec.size(), {}, directory, name);
 
       auto data_path = std::filesystem::path(directory) / (name + ".dat");
       std::ofstream fout(data_path, std::ios::out | std::ios::binary);
-      fout.write(reinterpret_cast<char*>(vec.data()), sizeof(std::remove_reference_t<decltype(vec)>::value_type) * vec.size()); // NOLINT(bugprone-narrowing-conversions)
+      fout.write(reinterpret_cast<const char*>(vec.data()), sizeof(float) * vec.size()); // NOLINT(bugprone-narrowing-conversions)
       fout.close();
     }
 
-    // Serialize a vector of tensors so that they are concatenated along the
-    // first axis.
-    void serialize_tensors(std::vector<Tensor<float>>& tensors, const std::string& directory, const std::string& name) {
+    // Serialize a vector of tensors so that they are concatenated along a new first
+    // axis.  Only the leading part of each tensor that fits record_shape is written.
+    template <class T, int64_t... Extents>
+    void serialize_tensors(const std::vector<Tensor<T, Extents...>>& tensors, const std::vector<int64_t>& record_shape,
+                           const std::string& directory, const std::string& name) {
       if (tensors.empty())
         return;
 
-      write_metadata(tensors, directory, name);
+      const auto record_size = std::accumulate(record_shape.begin(), record_shape.end(), int64_t{1}, std::multiplies<>());
+      assert((record_size <= Tensor<T, Extents...>::size));
+
+      write_metadata<T>(tensors.size(), record_shape, directory, name);
 
       auto data_path = std::filesystem::path(directory) / (name + ".dat");
       std::ofstream fout(data_path, std::ios::out | std::ios::binary);
       for (auto& tensor : tensors)
-        fout.write(reinterpret_cast<char*>(tensor.data.data()), sizeof(decltype(tensor.data)::value_type) * tensor.data.size()); // NOLINT(bugprone-narrowing-conversions)
+        fout.write(reinterpret_cast<const char*>(tensor.data.data()), sizeof(T) * record_size); // NOLINT(bugprone-narrowing-conversions)
       fout.close();
     }
   }
@@ -129,6 +104,7 @@ namespace zero {
   void ExperienceCollector::serialize_binary(const std::string& directory, const std::string& label) {
     if (! states.size())
       return;
+    const trace::Scope scope("serialize_experience");
 
     if (std::filesystem::exists(directory)) {
       if (! std::filesystem::is_directory(directory))
@@ -137,8 +113,8 @@ namespace zero {
     else
       std::filesystem::create_directory(directory);
   
-    serialize_tensors(states, directory, "states" + label);
-    serialize_tensors(visit_counts, directory, "visit_counts" + label);
+    serialize_tensors(states, {num_planes_, chess::GRID_SIZE, chess::GRID_SIZE}, directory, "states" + label);
+    serialize_tensors(visit_counts, {PRIOR_SHAPE[0], PRIOR_SHAPE[1], PRIOR_SHAPE[2]}, directory, "visit_counts" + label);
     serialize_vector(rewards, directory, "rewards" + label);
   }
 
@@ -1,53 +1,58 @@
 #ifndef EXPERIENCE_H
 #define EXPERIENCE_H
 
+#include <algorithm>
 #include <vector>
-#include <iterator>
+#include <string>
+#include <cassert>
 
-#include "tensor.h"
+#include "encoder.h"
 #include "../chess/pieces.h"
 
 namespace zero {
 
-  /// Two possible implementations:
-  /// 1. Use a tensor that grows in first dimension with an append function
-  /// 2. Use a vector<tensor>, and preferably std::move tensors into the vector
-  /// when appending.
+  /// Collects encoded states, root visit counts and rewards from self-play.
   ///
-  /// The second method avoids needing to reallocate each time to keep the
-  /// memory contiguous.
+  /// Records are fixed-size tensors stored by value, so recording a decision does not
+  /// allocate once the vectors have grown.  The number of input planes actually used by
+  /// the encoder is given at construction and determines the serialized state shape.
   class ExperienceCollector {
   public:
-    std::vector<Tensor<float>> states;
-    std::vector<Tensor<float>> visit_counts;
+    std::vector<InputTensor> states;
+    std::vector<PolicyTensor> visit_counts;
     std::vector<float> rewards;
 
   private:
-    std::vector<Tensor<float>> current_episode_states;
-    std::vector<Tensor<float>> current_episode_visit_counts;
+    int num_planes_;
+    std::vector<InputTensor> current_episode_states;
+    std::vector<PolicyTensor> current_episode_visit_counts;
     std::vector<chess::Color> current_episode_sides;
   
   public:
 
+    ExperienceCollector(int num_planes) : num_planes_(num_planes) {
+      assert(num_planes <= MAX_INPUT_PLANES);
+    }
+
     void begin_episode() {
       current_episode_states.clear();
       current_episode_visit_counts.clear();
       current_episode_sides.clear();
     }
 
-    void record_decision(Tensor<float>&& state, Tensor<float>&& visit_counts, chess::Color side) {
-      current_episode_states.push_back(std::move(state));
-      current_episode_visit_counts.push_back(std::move(visit_counts));
+    void record_decision(const InputTensor& state, const PolicyTensor& visit_counts, chess::Color side) {
+      // Only the first num_planes_ planes are serialized, but clear the rest so that
+      // the stored records do not depend on what the caller left in them.
+      auto& stored = current_episode_states.emplace_back(state);
+      std::fill(stored.data.begin() + num_planes_ * chess::GRID_SIZE * chess::GRID_SIZE, stored.data.end(), 0.0f);
+      current_episode_visit_counts.push_back(visit_counts);
       current_episode_sides.push_back(side);
     }
 
     void complete_episode(float white_reward) {
-      states.insert(states.end(),
-                    std::make_move_iterator(current_episode_states.begin()),
-                    std::make_move_iterator(current_episode_states.end()));
+      states.insert(states.end(), current_episode_states.begin(), current_episode_states.end());
       visit_counts.insert(visit_counts.end(),
-                          std::make_move_iterator(current_episode_visit_counts.begin()),
-                          std::make_move_iterator(current_episode_visit_counts.end()));
+                          current_episode_visit_counts.begin(), current_episode_visit_counts.end());
       assert(current_episode_states.size() == current_episode_sides.size());
       for (const auto& side : current_episode_sides)
         rewards.push_back(side == chess::Color::white ? white_reward : -white_reward);
@@ -59,13 +64,10 @@ namespace zero {
     }
 
     /// Append data from other.
-    void append(ExperienceCollector&& other) {
-      states.insert(states.end(),
-                    std::make_move_iterator(other.states.begin()),
-                    std::make_move_iterator(other.states.end()));
-      visit_counts.insert(visit_counts.end(),
-                          std::make_move_iterator(other.visit_counts.begin()),
-                          std::make_move_iterator(other.visit_counts.end()));
+    void append(const ExperienceCollector& other) {
+      assert(other.num_planes_ == num_planes_);
+      states.insert(states.end(), other.states.begin(), other.states.end());
+      visit_counts.insert(visit_counts.end(), other.visit_counts.begin(), other.visit_counts.end());
       rewards.insert(rewards.end(), other.rewards.begin(), other.rewards.end());
     }
 
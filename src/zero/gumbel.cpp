@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+
+#include "gumbel.h"
+#include "../myrand.h"
+
+using chess::Move;
+
+
+namespace zero {
+
+  GumbelRoot::GumbelRoot(const ZeroNode& root, int num_playouts, int num_considered,
+                         float c_visit, float c_scale, bool add_noise) :
+    c_visit_(c_visit), c_scale_(c_scale) {
+    std::extreme_value_distribution<float> gumbel;
+    for (const auto& [move, branch] : root.branches) {
+      moves_.push_back(move);
+      priors_.push_back(branch.prior);
+      logits_.push_back(std::log(std::max(branch.prior, std::numeric_limits<float>::min())));
+      noise_.push_back(add_noise ? gumbel(rng) : 0.0f);
+    }
+    num_considered = std::min(num_considered, static_cast<int>(moves_.size()));
+    considered_visits_ = considered_visits(num_considered, num_playouts);
+  }
+
+  std::vector<int> GumbelRoot::considered_visits(int num_considered, int num_playouts) {
+    std::vector<int> sequence;
+    if (num_considered <= 1) {
+      for (int i=0; i<num_playouts; ++i)
+        sequence.push_back(i);
+      return sequence;
+    }
+    const auto num_phases = static_cast<int>(std::ceil(std::log2(num_considered)));
+    std::vector<int> visits(num_considered, 0);
+    while (static_cast<int>(sequence.size()) < num_playouts) {
+      const int extra_visits = std::max(1, num_playouts / (num_phases * num_considered));
+      for (int i=0; i<extra_visits; ++i) {
+        sequence.insert(sequence.end(), visits.begin(), visits.begin() + num_considered);
+        for (int j=0; j<num_considered; ++j)
+          ++visits[j];
+      }
+      num_considered = std::max(2, num_considered / 2);
+    }
+    sequence.resize(num_playouts);
+    return sequence;
+  }
+
+  std::vector<float> GumbelRoot::transformed_q(const ZeroNode& root) const {
+    // Mixed value: the network value of the root averaged with the prior weighted Q of
+    // the visited moves, with the weight of their visits.
+    int total_visits = 0;
+    int max_visits = 0;
+    float visited_prior = 0.0;
+    float weighted_q = 0.0;
+    for (size_t i=0; i<moves_.size(); ++i) {
+      const auto& branch = root.branches.at(moves_[i]);
+      total_visits += branch.visit_count;
+      max_visits = std::max(max_visits, branch.visit_count);
+      if (branch.visit_count > 0) {
+        visited_prior += priors_[i];
+        weighted_q += priors_[i] * branch.expected_value(0.0);
+      }
+    }
+    auto mixed_value = root.value;
+    if (total_visits > 0 && visited_prior > 0)
+      mixed_value = (root.value + static_cast<float>(total_visits) * weighted_q / visited_prior)
+        / static_cast<float>(1 + total_visits);
+
+    std::vector<float> q(moves_.size());
+    for (size_t i=0; i<moves_.size(); ++i) {
+      const auto& branch = root.branches.at(moves_[i]);
+      q[i] = branch.visit_count > 0 || branch.proven != Proven::unknown ? branch.expected_value(0.0) : mixed_value;
+    }
+    const auto [min_q, max_q] = std::minmax_element(q.begin(), q.end());
+    const auto low = *min_q;
+    const auto range = std::max(*max_q - low, 1e-8f);
+    const auto scale = (c_visit_ + static_cast<float>(max_visits)) * c_scale_;
+    for (auto& value : q)
+      value = scale * (value - low) / range;
+    return q;
+  }
+
+  std::vector<float> GumbelRoot::scores(const ZeroNode& root) const {
+    auto result = transformed_q(root);
+    for (size_t i=0; i<result.size(); ++i)
+      result[i] += noise_[i] + logits_[i];
+    return result;
+  }
+
+  Move GumbelRoot::select(const ZeroNode& root, int playout) const {
+    if (playout >= static_cast<int>(considered_visits_.size()))
+      return best_move(root);
+    // The best scoring move among those with the visit count of this playout, which
+    // are the moves still considered.
+    const auto target = considered_visits_[static_cast<size_t>(playout)];
+    const auto score = scores(root);
+    size_t best = 0;
+    auto best_score = -std::numeric_limits<float>::infinity();
+    for (size_t i=0; i<moves_.size(); ++i) {
+      if (root.branches.at(moves_[i]).visit_count == target && score[i] > best_score) {
+        best = i;
+        best_score = score[i];
+      }
+    }
+    return moves_[best];
+  }
+
+  Move GumbelRoot::best_move(const ZeroNode& root) const {
+    if (root.proven != Proven::unknown)
+      return root.get_best_move();
+    int max_visits = 0;
+    for (const auto& move : moves_)
+      max_visits = std::max(max_visits, root.branches.at(move).visit_count);
+    const auto score = scores(root);
+    size_t best = 0;
+    auto best_score = -std::numeric_limits<float>::infinity();
+    for (size_t i=0; i<moves_.size(); ++i) {
+      if (root.branches.at(moves_[i]).visit_count == max_visits && score[i] > best_score) {
+        best = i;
+        best_score = score[i];
+      }
+    }
+    return moves_[best];
+  }
+
+  std::vector<std::pair<Move, float>> GumbelRoot::improved_policy(const ZeroNode& root) const {
+    auto logits = transformed_q(root);
+    for (size_t i=0; i<logits.size(); ++i)
+      logits[i] += logits_[i];
+    const auto max_logit = *std::max_element(logits.begin(), logits.end());
+    float sum = 0.0;
+    for (auto& logit : logits) {
+      logit = std::exp(logit - max_logit);
+      sum += logit;
+    }
+    std::vector<std::pair<Move, float>> policy;
+    policy.reserve(moves_.size());
+    for (size_t i=0; i<moves_.size(); ++i)
+      policy.emplace_back(moves_[i], logits[i] / sum);
+    return policy;
+  }
+
+};
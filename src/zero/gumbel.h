@@ -0,0 +1,58 @@
+#ifndef GUMBEL_H
+#define GUMBEL_H
+
+#include <vector>
+
+#include "agent_zero.h"
+
+namespace zero {
+
+  /// Root move selection of Gumbel AlphaZero (Danihelka et al., "Policy improvement by
+  /// planning with Gumbel", 2022), for searches with few playouts.
+  ///
+  /// The root moves are ranked by Gumbel noise plus prior logits, and the playouts are
+  /// spread over the best num_considered of them by sequential halving: each phase
+  /// visits the remaining moves equally, then keeps the better half by noise, logits
+  /// and sigma(Q).  The move played is the one left at the end, and the policy target
+  /// is the softmax of logits plus sigma(completed Q), which also covers unvisited
+  /// moves.  Nodes below the root are selected by PUCT as usual.
+  class GumbelRoot {
+  public:
+    /// Plan num_playouts playouts from root, which must have been evaluated.  Without
+    /// noise the moves are ranked by their priors alone.
+    GumbelRoot(const ZeroNode& root, int num_playouts, int num_considered,
+               float c_visit, float c_scale, bool add_noise);
+
+    /// Root move for the next playout, given the number of playouts so far.
+    chess::Move select(const ZeroNode& root, int playout) const;
+
+    /// Move to play: the best of the moves that were visited most, or the proven best
+    /// move.
+    chess::Move best_move(const ZeroNode& root) const;
+
+    /// Improved policy over all the root moves, paired with the moves.
+    std::vector<std::pair<chess::Move, float>> improved_policy(const ZeroNode& root) const;
+
+    /// Visit count that the move selected by each playout has before it, for
+    /// num_considered moves halved down to 2.
+    static std::vector<int> considered_visits(int num_considered, int num_playouts);
+
+  private:
+    /// Gumbel noise plus logits plus sigma(completed Q) of each move.
+    std::vector<float> scores(const ZeroNode& root) const;
+    /// sigma(completed Q) of each move, where unvisited moves get the value mixed from
+    /// the network value and the Q of the visited moves, rescaled to [0, 1].
+    std::vector<float> transformed_q(const ZeroNode& root) const;
+
+    std::vector<chess::Move> moves_;
+    std::vector<float> priors_;
+    std::vector<float> logits_;
+    std::vector<float> noise_;
+    std::vector<int> considered_visits_;
+    float c_visit_;
+    float c_scale_;
+  };
+
+};
+
+#endif // GUMBEL_H
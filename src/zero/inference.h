@@ -4,45 +4,158 @@
 #include <optional>
 #include <array>
 #include <algorithm>
+#include <numeric>
+#include <functional>
+#include <iterator>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
 
 #include <onnxruntime_cxx_api.h>
 
+#include "../utils.h"
+#include "../trace.h"
 #include "tensor.h"
 #include "encoder.h" // PRIOR_SHAPE
+#include "inference_options.h"
 
 
 namespace zero {
 
+  /// Input and output for networks with the legal-move signature (see
+  /// nn/onnx_export.py), which gather the policy of the legal moves and apply the
+  /// softmax in the graph.
+  struct LegalMoves {
+    /// Flattened indices into the 73x8x8 policy, one per move.
+    std::vector<int64_t> indices;
+    float temperature = 1.0;
+    /// Softmax over the moves, written by the network.
+    std::vector<float> priors;
+  };
+
+  /// ONNX Runtime state shared by all models in a process: the environment, and a
+  /// container for prepacked weights, so that sessions for the same network share one
+  /// copy of the prepacked kernels.
+  struct InferenceEnvironment {
+    Ort::Env env;
+    Ort::PrepackedWeightsContainer prepacked_weights;
+    /// Whether the environment owns global thread pools for sessions to share.
+    bool global_threads = false;
+    int intra_threads = 0;
+    int inter_threads = 0;
+
+    InferenceEnvironment() = default;
+
+    /// Environment with global thread pools of the given sizes.
+    InferenceEnvironment(int intra_threads, int inter_threads) :
+      env(make_threading_options(intra_threads, inter_threads), ORT_LOGGING_LEVEL_WARNING, "dlchess"),
+      global_threads(true), intra_threads(intra_threads), inter_threads(inter_threads) {}
+
+    /// The process-wide environment, with global thread pools if the options request
+    /// them.  ONNX Runtime has one environment per process, so this throws if the
+    /// existing environment has different thread pools and is still in use.
+    static std::shared_ptr<InferenceEnvironment> shared(const InferenceOptions& options = {}) {
+      static std::shared_ptr<InferenceEnvironment> environment;
+      if (environment && environment->matches(options))
+        return environment;
+      if (environment && environment.use_count() > 1)
+        throw std::runtime_error("global thread pool options differ from those of the existing inference environment");
+      // Release the previous environment before creating the new one.
+      environment.reset();
+      if (options.global_threads)
+        environment = std::make_shared<InferenceEnvironment>(options.intra_threads, options.inter_threads);
+      else
+        environment = std::make_shared<InferenceEnvironment>();
+      return environment;
+    }
+
+  private:
+    static Ort::ThreadingOptions make_threading_options(int intra_threads, int inter_threads) {
+      Ort::ThreadingOptions threading_options;
+      threading_options.SetGlobalIntraOpNumThreads(intra_threads);
+      threading_options.SetGlobalInterOpNumThreads(inter_threads);
+      return threading_options;
+    }
+
+    bool matches(const InferenceOptions& options) const {
+      if (! options.global_threads)
+        // Sessions with their own thread pools can use any environment.
+        return true;
+      return global_threads && intra_threads == options.intra_threads && inter_threads == options.inter_threads;
+    }
+  };
+
+  /// Execution providers available in this ONNX Runtime build, by the names used in
+  /// InferenceOptions.
+  inline std::vector<std::string> available_providers() {
+    std::vector<std::string> providers;
+    for (const auto& name : Ort::GetAvailableProviders()) {
+      if (name == "CPUExecutionProvider")
+        providers.emplace_back("cpu");
+      else if (name == "XnnpackExecutionProvider")
+        providers.emplace_back("xnnpack");
+      else if (name == "DnnlExecutionProvider")
+        providers.emplace_back("dnnl");
+    }
+    return providers;
+  }
+
   class InferenceModel {
 
     Ort::MemoryInfo memory_info{nullptr};
 
-    Ort::Env env;
+    std::shared_ptr<InferenceEnvironment> environment;
+    // The session may refer to the model bytes, so the mapping must outlive it.
+    utils::MappedFile model_file;
     Ort::Session session{nullptr};
-    // Since there is only one input name, we can get the necessary pointer with
-    // input_name.c_str() and pass that to session.Run.  Thus, we don't need to
-    // store a "char" version separately.
-    std::string input_name;
-    std::array<const char*, 1> input_names_char;
+    std::vector<std::string> input_names;
+    std::vector<const char*> input_names_char;
     std::array<std::string, 2> output_names;
     std::array<const char*, 2> output_names_char;
+    bool packed_input_;
+    bool legal_move_output_;
+    bool dynamic_batch_;
 
   public:
-    InferenceModel(const char* model_path, std::optional<int> num_threads) {
+    InferenceModel(const char* model_path, const InferenceOptions& options = {},
+                   std::shared_ptr<InferenceEnvironment> env = nullptr) :
+      environment(env ? std::move(env) : InferenceEnvironment::shared(options)), model_file(model_path) {
 
       memory_info = Ort::MemoryInfo::CreateCpu(OrtDeviceAllocator, OrtMemTypeCPU);
-      Ort::SessionOptions sessionOptions;
-      if (num_threads)
-        sessionOptions.SetIntraOpNumThreads(num_threads.value());
-      session = Ort::Session(env, model_path, sessionOptions);
+      Ort::SessionOptions sessionOptions = make_session_options(options);
+      if (std::string_view(model_path).ends_with(".ort")) {
+        // Models in ORT format can use the mapped bytes for the weights instead of
+        // copying them, so processes using the same file share the weight pages.
+        sessionOptions.AddConfigEntry("session.use_ort_model_bytes_directly", "1");
+        sessionOptions.AddConfigEntry("session.use_ort_model_bytes_for_initializers", "1");
+      }
+      session = Ort::Session(environment->env, model_file.data(), model_file.size(), sessionOptions,
+                             environment->prepacked_weights);
 
       // Get the input and output names:
-      assert(session.GetInputCount() == 1);
-      assert(session.GetOutputCount() == 2);
+      const auto num_inputs = session.GetInputCount();
+      const auto num_outputs = session.GetOutputCount();
+      if ((num_inputs != 1 && num_inputs != 3) || num_outputs != 2)
+        throw std::runtime_error(std::string("unexpected network signature in ") + model_path + ": "
+                                 + std::to_string(num_inputs) + " inputs and " + std::to_string(num_outputs)
+                                 + " outputs, expected 1 or 3 inputs and 2 outputs");
       const Ort::AllocatorWithDefaultOptions allocator;
-      input_name = session.GetInputNameAllocated(0, allocator).get();
-      input_names_char[0] = input_name.c_str();
-      for (int i=0; i<session.GetOutputCount(); ++i) {
+      for (size_t i=0; i<num_inputs; ++i)
+        input_names.emplace_back(session.GetInputNameAllocated(i, allocator).get());
+      std::transform(std::begin(input_names), std::end(input_names), std::back_inserter(input_names_char),
+                     [&](const std::string& str) { return str.c_str(); });
+      // Networks exported with packed input take uint8 data from Encoder::encode_packed.
+      const auto input_info = session.GetInputTypeInfo(0).GetTensorTypeAndShapeInfo();
+      packed_input_ = input_info.GetElementType() == ONNX_TENSOR_ELEMENT_DATA_TYPE_UINT8;
+      // A dynamic axis has a negative size.
+      dynamic_batch_ = input_info.GetShape().at(0) < 0;
+      // Networks exported with legal-move output take the move indices and softmax
+      // temperature as extra inputs.
+      legal_move_output_ = input_names.size() == 3;
+      for (size_t i=0; i<num_outputs; ++i) {
         output_names[i] = session.GetOutputNameAllocated(i, allocator).get();
       }
       std::transform(std::begin(output_names), std::end(output_names), std::begin(output_names_char),
@@ -50,40 +163,177 @@ namespace zero {
 
     }
 
-    std::array<Tensor<float>, 2> operator() (Tensor<float>& input_tensor) {
-      auto ort_input_value = Ort::Value::CreateTensor<float>(memory_info,
-                                                          input_tensor.data.data(), input_tensor.data.size(),
-                                                          input_tensor.shape.data(), input_tensor.shape.size());
+    /// Whether the network takes packed input instead of float planes.
+    bool packed_input() const {
+      return packed_input_;
+    }
 
-      const std::vector<int64_t> policy_shape = {1, PRIOR_SHAPE[0], PRIOR_SHAPE[1], PRIOR_SHAPE[2]};
-      const std::vector<int64_t> value_shape = {1, 1};
-      // Pre-allocate the memory for the results:
-      std::array<Tensor<float>, 2> output_tensors = {
-        Tensor<float>(policy_shape),
-        Tensor<float>(value_shape),
-      };
+    /// Whether the network takes legal moves and outputs their softmax, instead of
+    /// outputting the full policy.
+    bool legal_move_output() const {
+      return legal_move_output_;
+    }
 
-      Ort::Value ort_outputs[] = { // NOLINT(modernize-avoid-c-arrays)
-        Ort::Value::CreateTensor<float>(memory_info,
-                                        output_tensors[0].data.data(), output_tensors[0].data.size(),
-                                        output_tensors[0].shape.data(), output_tensors[0].shape.size()),
-        Ort::Value::CreateTensor<float>(memory_info,
-                                        output_tensors[1].data.data(), output_tensors[1].data.size(),
-                                        output_tensors[1].shape.data(), output_tensors[1].shape.size()),
-      };
+    /// Whether the network accepts batches of more than one position.
+    bool dynamic_batch() const {
+      return dynamic_batch_;
+    }
+
+    /// Evaluate the network on one position encoded with Encoder::encode, writing the
+    /// policy and returning the value.
+    float operator() (InputTensor& input, int num_planes, PolicyTensor& policy) {
+      assert(! packed_input_ && ! legal_move_output_);
+      return run(input.data.data(), input_shape(num_planes), policy);
+    }
 
-      session.Run(Ort::RunOptions{nullptr}, input_names_char.data(), &ort_input_value, 1,
-                  output_names_char.data(), ort_outputs, output_names.size());
-      return output_tensors;
+    /// Evaluate the network on one position encoded with Encoder::encode_packed.
+    float operator() (PackedInputTensor& input, int packed_size, PolicyTensor& policy) {
+      assert(packed_input_ && ! legal_move_output_);
+      return run(input.data.data(), packed_input_shape(packed_size), policy);
+    }
 
+    /// Evaluate a network with the legal-move signature, writing the move priors.
+    float operator() (InputTensor& input, int num_planes, LegalMoves& moves) {
+      assert(! packed_input_ && legal_move_output_);
+      return run(input.data.data(), input_shape(num_planes), moves);
+    }
+
+    float operator() (PackedInputTensor& input, int packed_size, LegalMoves& moves) {
+      assert(packed_input_ && legal_move_output_);
+      return run(input.data.data(), packed_input_shape(packed_size), moves);
+    }
 
-      // A simpler alternative was to return ORT allocated vector of outputs,
-      // but then they are ORT Value tensors, so we don't get to use our wrapper
-      // for accessing them.
-      // return session.Run(Ort::RunOptions{nullptr}, input_names_char.data(), &ort_input_value, 1,
-      //                    output_names_char.data(), output_names.size());
+    /// Evaluate a batch of positions encoded with Encoder::encode_batch, writing
+    /// batch_size policies of PolicyTensor::size entries, and batch_size values.
+    /// Batches of more than one position need a network with a dynamic batch size.
+    void operator() (float* input, int num_planes, int batch_size, float* policies, float* values) {
+      assert(! packed_input_ && ! legal_move_output_);
+      assert(batch_size == 1 || dynamic_batch_);
+      run(input, input_shape(num_planes, batch_size), policies, values);
     }
 
+    /// Evaluate a batch of positions encoded with Encoder::encode_packed_batch.
+    void operator() (uint8_t* input, int packed_size, int batch_size, float* policies, float* values) {
+      assert(packed_input_ && ! legal_move_output_);
+      assert(batch_size == 1 || dynamic_batch_);
+      run(input, packed_input_shape(packed_size, batch_size), policies, values);
+    }
+
+  private:
+    Ort::SessionOptions make_session_options(const InferenceOptions& options) const {
+      Ort::SessionOptions sessionOptions;
+      sessionOptions.SetGraphOptimizationLevel(optimization_level(options.optimization));
+      sessionOptions.SetExecutionMode(options.parallel ? ORT_PARALLEL : ORT_SEQUENTIAL);
+      if (options.global_threads) {
+        if (! environment->global_threads)
+          throw std::runtime_error("global thread pool requested, but the inference environment has none");
+        sessionOptions.DisablePerSessionThreads();
+      }
+      else {
+        if (options.intra_threads > 0)
+          sessionOptions.SetIntraOpNumThreads(options.intra_threads);
+        if (options.inter_threads > 0)
+          sessionOptions.SetInterOpNumThreads(options.inter_threads);
+      }
+
+      const auto providers = available_providers();
+      if (std::find(providers.begin(), providers.end(), options.provider) == providers.end()) {
+        std::string msg = "execution provider not available: " + options.provider + " (available:";
+        for (const auto& p : providers)
+          msg += " " + p;
+        throw std::runtime_error(msg + ")");
+      }
+      if (options.provider == "xnnpack") {
+        // XNNPACK has its own thread pool, so the recommendation is to give the session
+        // pool a single thread to avoid contention.
+        std::unordered_map<std::string, std::string> xnnpack_options;
+        if (options.intra_threads > 0)
+          xnnpack_options["intra_op_num_threads"] = std::to_string(options.intra_threads);
+        if (! options.global_threads)
+          sessionOptions.SetIntraOpNumThreads(1);
+        sessionOptions.AppendExecutionProvider("XNNPACK", xnnpack_options);
+      }
+      else if (options.provider == "dnnl") {
+        const auto& api = Ort::GetApi();
+        OrtDnnlProviderOptions* dnnl_options = nullptr;
+        Ort::ThrowOnError(api.CreateDnnlProviderOptions(&dnnl_options));
+        const std::unique_ptr<OrtDnnlProviderOptions, decltype(api.ReleaseDnnlProviderOptions)>
+          dnnl_options_ptr(dnnl_options, api.ReleaseDnnlProviderOptions);
+        Ort::ThrowOnError(api.SessionOptionsAppendExecutionProvider_Dnnl(sessionOptions, dnnl_options));
+      }
+      return sessionOptions;
+    }
+
+    static GraphOptimizationLevel optimization_level(const std::string& name) {
+      if (name == "disable")
+        return ORT_DISABLE_ALL;
+      if (name == "basic")
+        return ORT_ENABLE_BASIC;
+      if (name == "extended")
+        return ORT_ENABLE_EXTENDED;
+      if (name == "all")
+        return ORT_ENABLE_ALL;
+      throw std::runtime_error("unknown graph optimization level: " + name);
+    }
+
+    static std::array<int64_t, 4> input_shape(int num_planes, int batch_size = 1) {
+      return {batch_size, num_planes, chess::GRID_SIZE, chess::GRID_SIZE};
+    }
+
+    static std::array<int64_t, 2> packed_input_shape(int packed_size, int batch_size = 1) {
+      return {batch_size, packed_size};
+    }
+
+    template <class T, size_t N>
+    Ort::Value make_value(T* data, const std::array<int64_t, N>& shape) {
+      const auto size = std::accumulate(shape.begin(), shape.end(), int64_t{1}, std::multiplies<>());
+      return Ort::Value::CreateTensor<T>(memory_info, data, size, shape.data(), shape.size());
+    }
+
+    template <class T, size_t N>
+    float run(T* input, const std::array<int64_t, N>& shape, PolicyTensor& policy) {
+      float value;
+      run(input, shape, policy.data.data(), &value);
+      return value;
+    }
+
+    template <class T, size_t N>
+    void run(T* input, const std::array<int64_t, N>& shape, float* policies, float* values) {
+      const std::array<int64_t, 4> policy_shape = {shape[0], PRIOR_SHAPE[0], PRIOR_SHAPE[1], PRIOR_SHAPE[2]};
+      std::array<Ort::Value, 1> inputs = {make_value(input, shape)};
+      run(inputs, make_value(policies, policy_shape), values, shape[0]);
+    }
+
+    template <class T, size_t N>
+    float run(T* input, const std::array<int64_t, N>& shape, LegalMoves& moves) {
+      const std::array<int64_t, 2> moves_shape = {1, static_cast<int64_t>(moves.indices.size())};
+      const std::array<int64_t, 1> temperature_shape = {1};
+      std::array<Ort::Value, 3> inputs = {
+        make_value(input, shape),
+        make_value(moves.indices.data(), moves_shape),
+        make_value(&moves.temperature, temperature_shape),
+      };
+      moves.priors.resize(moves.indices.size());
+      float value;
+      run(inputs, make_value(moves.priors.data(), moves_shape), &value, 1);
+      return value;
+    }
+
+    /// Run the session, with the policy written to the memory of the given value, and
+    /// the values of the batch to the given array.
+    template <size_t N>
+    void run(std::array<Ort::Value, N>& inputs, Ort::Value policy, float* values, int64_t batch_size) {
+      assert(N == input_names.size());
+      const std::array<int64_t, 2> value_shape = {batch_size, 1};
+      Ort::Value outputs[] = { // NOLINT(modernize-avoid-c-arrays)
+        std::move(policy),
+        make_value(values, value_shape),
+      };
+
+      const trace::Scope scope("ort_run");
+      session.Run(Ort::RunOptions{nullptr}, input_names_char.data(), inputs.data(), N,
+                  output_names_char.data(), outputs, output_names.size());
+    }
   };
 
 };
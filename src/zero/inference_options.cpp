@@ -0,0 +1,99 @@
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <array>
+
+#include "inference_options.h"
+
+
+namespace {
+
+  constexpr std::array<const char*, 3> PROVIDERS = {"cpu", "xnnpack", "dnnl"};
+  constexpr std::array<const char*, 4> OPTIMIZATION_LEVELS = {"disable", "basic", "extended", "all"};
+
+  template <size_t N>
+  const std::string& parse_choice(const std::string& name, const std::string& value,
+                                  const std::array<const char*, N>& choices) {
+    if (std::find(choices.begin(), choices.end(), value) == choices.end())
+      throw std::invalid_argument("invalid value for inference option " + name + ": " + value);
+    return value;
+  }
+
+  int parse_threads(const std::string& name, const std::string& value) {
+    size_t pos = 0;
+    int n = -1;
+    try {
+      n = std::stoi(value, &pos);
+    } catch (const std::logic_error&) {} // NOLINT(bugprone-empty-catch)
+    if (n < 0 || pos != value.size())
+      throw std::invalid_argument("invalid value for inference option " + name + ": " + value);
+    return n;
+  }
+
+  bool parse_bool(const std::string& name, const std::string& value) {
+    if (value == "true")
+      return true;
+    if (value == "false")
+      return false;
+    throw std::invalid_argument("invalid value for inference option " + name + ": " + value);
+  }
+
+};
+
+namespace zero {
+
+  void InferenceOptions::set(const std::string& name, const std::string& value) {
+    if (name == "provider")
+      provider = parse_choice(name, value, PROVIDERS);
+    else if (name == "optimization")
+      optimization = parse_choice(name, value, OPTIMIZATION_LEVELS);
+    else if (name == "intra_threads")
+      intra_threads = parse_threads(name, value);
+    else if (name == "inter_threads")
+      inter_threads = parse_threads(name, value);
+    else if (name == "parallel")
+      parallel = parse_bool(name, value);
+    else if (name == "global_threads")
+      global_threads = parse_bool(name, value);
+    else
+      throw std::invalid_argument("unknown inference option: " + name);
+  }
+
+  InferenceOptions InferenceOptions::load(const std::string& path) {
+    std::ifstream infile(path);
+    if (! infile)
+      throw std::runtime_error("unable to open file: " + path);
+
+    InferenceOptions options;
+    std::string line;
+    while (std::getline(infile, line)) {
+      if (line.empty() || line.starts_with('#'))
+        continue;
+      std::istringstream iss(line);
+      std::string name, value;
+      iss >> name >> value;
+      options.set(name, value);
+    }
+    return options;
+  }
+
+  void InferenceOptions::save(const std::string& path) const {
+    std::ofstream fout(path, std::ios::out);
+    if (! fout)
+      throw std::runtime_error("unable to open file: " + path);
+    fout << *this;
+  }
+
+  std::ostream& operator<<(std::ostream& os, const InferenceOptions& options) {
+    os << std::boolalpha;
+    os << "provider " << options.provider << "\n";
+    os << "optimization " << options.optimization << "\n";
+    os << "intra_threads " << options.intra_threads << "\n";
+    os << "inter_threads " << options.inter_threads << "\n";
+    os << "parallel " << options.parallel << "\n";
+    os << "global_threads " << options.global_threads << "\n";
+    return os << std::noboolalpha;
+  }
+
+};
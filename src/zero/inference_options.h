@@ -0,0 +1,43 @@
+#ifndef INFERENCE_OPTIONS_H
+#define INFERENCE_OPTIONS_H
+
+#include <string>
+#include <ostream>
+
+
+namespace zero {
+
+  /// ONNX Runtime session settings: execution provider, graph optimization level, and
+  /// threading.  These can be saved to and loaded from a simple text file with one
+  /// "name value" pair per line, as written by the autotune program.
+  struct InferenceOptions {
+    /// Execution provider: "cpu", "xnnpack", or "dnnl".
+    std::string provider = "cpu";
+    /// Graph optimization level: "disable", "basic", "extended", or "all".
+    std::string optimization = "all";
+    /// Threads used within an operator.  Zero uses the ONNX Runtime default.
+    int intra_threads = 0;
+    /// Threads used to run independent operators, with parallel execution.
+    int inter_threads = 0;
+    /// Run independent operators in parallel instead of sequentially.
+    bool parallel = false;
+    /// Use thread pools owned by the environment and shared by all sessions in the
+    /// process, instead of per-session pools.
+    bool global_threads = false;
+
+    /// Set an option by the name used in the file format.  Throws
+    /// std::invalid_argument for an unknown name or invalid value.
+    void set(const std::string& name, const std::string& value);
+
+    static InferenceOptions load(const std::string& path);
+    void save(const std::string& path) const;
+
+    bool operator==(const InferenceOptions&) const = default;
+  };
+
+  /// Write the options in the file format.
+  std::ostream& operator<<(std::ostream&, const InferenceOptions&);
+
+};
+
+#endif // INFERENCE_OPTIONS_H
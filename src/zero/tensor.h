@@ -1,70 +1,59 @@
 #ifndef TENSOR_H_
 #define TENSOR_H_
 
-#include <vector>
-#include <initializer_list>
-#include <numeric>
+#include <array>
 #include <cassert>
 #include <cstdint>
 
 
 namespace zero {
 
-  template <class T>
+  /// Row-major tensor with extents fixed at compile time.
+  ///
+  /// Storage is inline and aligned to a cache line, so tensors can be placed on the
+  /// stack or in containers without separate allocations, and the data can be handed
+  /// directly to vectorized code or the inference backend.
+  template <class T, int64_t... Extents>
   struct Tensor {
-    std::vector<T> data;
-    std::vector<int64_t> shape;
-    std::vector<int64_t> strides;
-
-    Tensor(const std::vector<int64_t>& shape) :
-      shape(shape) {
-
-      // Initialize data.  Todo: there might be a way to do this in the
-      // initializer list, using a constexpr function for product.
-      int64_t n = 1;
-      for (auto& i : shape) n *= i;
-      data.resize(n);
-
-      strides.resize(shape.size(), 1);
+    static constexpr int64_t size = (Extents * ...);
+    static constexpr std::array<int64_t, sizeof...(Extents)> shape = {Extents...};
+    static constexpr std::array<int64_t, sizeof...(Extents)> strides = [] {
+      std::array<int64_t, sizeof...(Extents)> s;
       int64_t val = 1;
-      for (int i=strides.size()-2; i>=0; --i) {
-        val *= shape[i+1];
-        strides[i] = val;
+      for (int i=s.size()-1; i>=0; --i) {
+        s[i] = val;
+        val *= shape[i];
       }
-    }
+      return s;
+    }();
 
-    int dim() const {
-      return shape.size();
-    }
+    alignas(64) std::array<T, size> data {};
 
-    // void clear() {
-    //   data.clear();
-    //   shape[0] = 0;
-    // }
-
-    T& at(std::initializer_list<int64_t> indices) {
-      assert(indices.size() == shape.size());
-      auto index = std::inner_product(indices.begin(), indices.end(), strides.begin(), 0l);
-      return data[index];
+    static constexpr int dim() {
+      return sizeof...(Extents);
     }
 
-    // Assuming shape NCWH, fill the data at [idx0, idx1, :, :]
-    void fill_channel(int64_t idx0, int64_t idx1, T val) {
-      assert(shape.size() == 4);
-      for (int i=0; i<shape[2]; ++i) {
-        for (int j=0; j<shape[3]; ++j) {
-          at({idx0, idx1, i, j}) = val;
-        }
+    template <class... Indices>
+    static constexpr int64_t index(Indices... indices) {
+      static_assert(sizeof...(Indices) == sizeof...(Extents));
+      const std::array<int64_t, sizeof...(Extents)> idx = {indices...};
+      int64_t result = 0;
+      for (int i=0; i<dim(); ++i) {
+        assert(idx[i] >= 0 && idx[i] < shape[i]);
+        result += idx[i] * strides[i];
       }
+      return result;
+    }
+
+    template <class... Indices>
+    constexpr T& at(Indices... indices) {
+      return data[index(indices...)];
     }
 
-    // void append(const Tensor<T>& other) {
-    //   assert(shape.size() == other.shape.size());
-    //   for (int i=1; i<shape.size(); ++i)
-    //     assert(shape[i] == other.shape[i]);
-    //   data.insert(data.end(), other.begin(), other.end());
-    //   ++shape[0];
-    // }
+    template <class... Indices>
+    constexpr const T& at(Indices... indices) const {
+      return data[index(indices...)];
+    }
   };
 
 };
@@ -73,6 +73,16 @@ def train(dataloader, model, optimizer, output_interval):
 @click.option("--input-conv", is_flag=True, help="include convolution before blocks")
 @click.option("--num-filters", default=64, show_default=True)
 @click.option("--num-blocks", default=4, show_default=True)
+@click.option(
+    "--packed-input",
+    is_flag=True,
+    help="export with packed uint8 input, unpacked inside the graph",
+)
+@click.option(
+    "--legal-move-output",
+    is_flag=True,
+    help="export with legal-move indices as input and the legal-move softmax as output",
+)
 def main(
     experience,
     query,
@@ -88,6 +98,8 @@ def main(
     input_conv,
     num_filters,
     num_blocks,
+    packed_input,
+    legal_move_output,
 ):
     THIS_DIR = os.path.abspath(os.path.dirname(__file__))
 
@@ -100,6 +112,7 @@ def main(
         from squeeze_net import ChessNet
     else:
         from conv_4x64 import ChessNet
+    from onnx_export import export_onnx
 
     if int(subset) == subset:
         subset = int(subset)
@@ -136,15 +149,12 @@ def main(
 
         # Export ONNX model
         model.eval()
-        X = torch.rand(
-            1, model.in_channels, model.grid_size, model.grid_size, requires_grad=True
-        )
-        torch.onnx.export(
+        export_onnx(
             model,
-            X,
             output_path.replace(".pt", ".onnx"),
-            input_names=["state"],
-            output_names=["policy", "value"],
+            encoding_version,
+            packed_input=packed_input,
+            legal_move_output=legal_move_output,
         )
 
 